@@ -0,0 +1,31 @@
+#pragma once
+
+#include <common/allocations_checker.h>
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+
+// Wraps the benchmark loop and reports "allocs_per_op" and "bytes_per_op" from the global
+// new/delete hooks. The counts are per thread, so multithreaded runs add up the share of every
+// thread. Pass the number of operations in one iteration for batched loops.
+class AllocationsPerOp {
+public:
+    explicit AllocationsPerOp(benchmark::State& state, int64_t ops_per_iteration = 1)
+        : state_(state), ops_per_iteration_(ops_per_iteration) {
+    }
+
+    ~AllocationsPerOp() {
+        alloc_checker::Stats delta = scope_.Delta();
+        double ops = static_cast<double>(ops_per_iteration_);
+        state_.counters["allocs_per_op"] = benchmark::Counter(
+            static_cast<double>(delta.allocations) / ops, benchmark::Counter::kAvgIterations);
+        state_.counters["bytes_per_op"] = benchmark::Counter(
+            static_cast<double>(delta.allocated_bytes) / ops, benchmark::Counter::kAvgIterations);
+    }
+
+private:
+    benchmark::State& state_;
+    int64_t ops_per_iteration_;
+    alloc_checker::AllocationScope scope_;
+};
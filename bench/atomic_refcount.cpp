@@ -0,0 +1,60 @@
+#include "allocation_counters.h"
+
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+
+// Every thread hammers the counters of one shared block, which is the worst case for the atomic
+// reference counting: all RMWs go to the same cache line.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SharedPtr<int> shared_value = MakeShared<int>(42);
+static WeakPtr<int> weak_value = shared_value;
+
+static std::shared_ptr<int> std_shared_value = std::make_shared<int>(42);
+static std::weak_ptr<int> std_weak_value = std_shared_value;
+
+static void BM_SharedPtrCopyDestroy(benchmark::State& state) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        SharedPtr<int> copy = shared_value;
+        benchmark::DoNotOptimize(copy);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_StdSharedPtrCopyDestroy(benchmark::State& state) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        std::shared_ptr<int> copy = std_shared_value;
+        benchmark::DoNotOptimize(copy);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_WeakPtrLock(benchmark::State& state) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        SharedPtr<int> locked = weak_value.Lock();
+        benchmark::DoNotOptimize(locked);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_StdWeakPtrLock(benchmark::State& state) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        std::shared_ptr<int> locked = std_weak_value.lock();
+        benchmark::DoNotOptimize(locked);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_SharedPtrCopyDestroy)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_StdSharedPtrCopyDestroy)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_WeakPtrLock)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_StdWeakPtrLock)->ThreadRange(1, 16)->UseRealTime();
@@ -0,0 +1,66 @@
+#include "allocation_counters.h"
+
+#include <shared-from-this/atomic_shared.h>
+
+#include <benchmark/benchmark.h>
+
+#include <mutex>
+
+// Read-mostly config publishing: every thread loads the current value, thread 0 also stores a new
+// one every `kStoreEvery` iterations. The mutex version is what the config path did before.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static constexpr int kStoreEvery = 1024;
+
+class MutexSharedPtr {
+public:
+    SharedPtr<int> Load() const {
+        std::lock_guard lock(mutex_);
+        return value_;
+    }
+
+    void Store(SharedPtr<int> desired) {
+        std::lock_guard lock(mutex_);
+        value_.Swap(desired);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    SharedPtr<int> value_ = MakeShared<int>(0);
+};
+
+static AtomicSharedPtr<int> atomic_config(MakeShared<int>(0));
+static MutexSharedPtr mutex_config;
+
+template <typename Config>
+static void BM_Load(benchmark::State& state, Config* config) {
+    int i = 0;
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        if (state.thread_index() == 0 && ++i % kStoreEvery == 0) {
+            config->Store(MakeShared<int>(i));
+        }
+        SharedPtr<int> current = config->Load();
+        benchmark::DoNotOptimize(*current);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Same load pattern, but the reader only protects the value with a hazard pointer
+static void BM_Protect(benchmark::State& state) {
+    HazardPointer hazard;
+    int i = 0;
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        if (state.thread_index() == 0 && ++i % kStoreEvery == 0) {
+            atomic_config.Store(MakeShared<int>(i));
+        }
+        benchmark::DoNotOptimize(*atomic_config.Protect(hazard));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(BM_Load, AtomicSharedPtr, &atomic_config)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Load, MutexSharedPtr, &mutex_config)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_Protect)->ThreadRange(1, 16)->UseRealTime();
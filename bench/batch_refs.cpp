@@ -0,0 +1,73 @@
+#include "allocation_counters.h"
+
+#include <intrusive/intrusive.h>
+#include <shared-from-this/shared.h>
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+// Fan-out: every thread copies one shared object into `state.range(0)` slots and drops the copies
+// again. One by one that is two RMWs per copy on the cache line all threads share, `CloneN` and
+// `ReleaseAll` take one each per batch.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Counted : SimpleRefCounted<Counted> {};
+
+static SharedPtr<int> shared_value = MakeShared<int>(42);
+static IntrusivePtr<Counted> intrusive_value = MakeIntrusive<Counted>();
+
+static void BM_SharedPtrCopyEach(benchmark::State& state) {
+    std::vector<SharedPtr<int>> slots(state.range(0));
+    AllocationsPerOp allocs(state, state.range(0));
+    for (auto _ : state) {
+        for (auto& slot : slots) {
+            slot = shared_value;
+        }
+        for (auto& slot : slots) {
+            slot.Reset();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_SharedPtrCloneN(benchmark::State& state) {
+    std::vector<SharedPtr<int>> slots(state.range(0));
+    AllocationsPerOp allocs(state, state.range(0));
+    for (auto _ : state) {
+        shared_value.CloneN(slots.size(), slots.begin());
+        SharedPtr<int>::ReleaseAll(slots.begin(), slots.end());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Single-threaded, `SimpleCounter` is not atomic
+static void BM_IntrusivePtrCopyEach(benchmark::State& state) {
+    std::vector<IntrusivePtr<Counted>> slots(state.range(0));
+    AllocationsPerOp allocs(state, state.range(0));
+    for (auto _ : state) {
+        for (auto& slot : slots) {
+            slot = intrusive_value;
+        }
+        for (auto& slot : slots) {
+            slot.Reset();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_IntrusivePtrCloneN(benchmark::State& state) {
+    std::vector<IntrusivePtr<Counted>> slots(state.range(0));
+    AllocationsPerOp allocs(state, state.range(0));
+    for (auto _ : state) {
+        intrusive_value.CloneN(slots.size(), slots.begin());
+        IntrusivePtr<Counted>::ReleaseAll(slots.begin(), slots.end());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_SharedPtrCopyEach)->Arg(64)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_SharedPtrCloneN)->Arg(64)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_IntrusivePtrCopyEach)->Arg(64);
+BENCHMARK(BM_IntrusivePtrCloneN)->Arg(64);
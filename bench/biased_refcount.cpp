@@ -0,0 +1,45 @@
+#include "allocation_counters.h"
+
+#include <shared-from-this/shared.h>
+
+#include <benchmark/benchmark.h>
+
+// Biased against plain atomic counting. Owner-heavy: every thread copies an object it created
+// itself. Cross-thread-heavy: thread 0 creates one object and all threads copy it, so only 1/N of
+// the copies take the biased path and the rest pay for the shared count.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename Factory>
+static void BM_OwnerCopy(benchmark::State& state, Factory make) {
+    auto ptr = make(42);
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto copy = ptr;
+        benchmark::DoNotOptimize(copy);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename Factory>
+static void BM_CrossThreadCopy(benchmark::State& state, Factory make) {
+    static decltype(make(42)) shared;
+    if (state.thread_index() == 0) {
+        shared = make(42);
+    }
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {  // waits for thread 0
+        auto copy = shared;
+        benchmark::DoNotOptimize(copy);
+    }
+    if (state.thread_index() == 0) {  // all copies are gone once the loop is over
+        shared.Reset();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(BM_OwnerCopy, SharedPtr, MakeShared<int, int>)->ThreadRange(1, 8);
+BENCHMARK_CAPTURE(BM_OwnerCopy, BiasedSharedPtr, MakeBiasedShared<int, int>)->ThreadRange(1, 8);
+BENCHMARK_CAPTURE(BM_CrossThreadCopy, SharedPtr, MakeShared<int, int>)->ThreadRange(1, 8);
+BENCHMARK_CAPTURE(BM_CrossThreadCopy, BiasedSharedPtr, MakeBiasedShared<int, int>)
+    ->ThreadRange(1, 8);
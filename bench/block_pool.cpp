@@ -0,0 +1,96 @@
+#include "allocation_counters.h"
+
+#include <shared-from-this/shared.h>
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+// `BlockPool` against the global allocator, and the two `SharedPtr` paths that allocate a block.
+// Build once as is and once with -DSMART_POINTERS_POOLED_BLOCKS to compare the latter, the label
+// says which allocator the blocks came from.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Pool {
+    static void* Allocate(size_t size) {
+        return BlockPool::Allocate(size);
+    }
+    static void Deallocate(void* ptr, size_t size) {
+        BlockPool::Deallocate(ptr, size);
+    }
+};
+
+struct Global {
+    static void* Allocate(size_t size) {
+        return ::operator new(size);
+    }
+    static void Deallocate(void* ptr, size_t size) {
+        ::operator delete(ptr, size);
+    }
+};
+
+// Latency of one allocation and free on a warm cache
+template <typename Allocator>
+static void BM_AllocateFree(benchmark::State& state) {
+    size_t size = state.range(0);
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        void* ptr = Allocator::Allocate(size);
+        benchmark::DoNotOptimize(ptr);
+        Allocator::Deallocate(ptr, size);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Many live blocks at once: the thread cache spills to the depot and refills from it
+template <typename Allocator>
+static void BM_Burst(benchmark::State& state) {
+    constexpr size_t kSize = 32;
+    std::vector<void*> blocks(state.range(0));
+    AllocationsPerOp allocs(state, state.range(0));
+    for (auto _ : state) {
+        for (auto& block : blocks) {
+            block = Allocator::Allocate(kSize);
+        }
+        benchmark::DoNotOptimize(blocks.data());
+        for (auto block : blocks) {
+            Allocator::Deallocate(block, kSize);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * blocks.size());
+}
+
+BENCHMARK_TEMPLATE(BM_AllocateFree, Pool)->Arg(32)->Arg(64)->Arg(128)->ThreadRange(1, 8);
+BENCHMARK_TEMPLATE(BM_AllocateFree, Global)->Arg(32)->Arg(64)->Arg(128)->ThreadRange(1, 8);
+BENCHMARK_TEMPLATE(BM_Burst, Pool)->Arg(1000)->Arg(100000);
+BENCHMARK_TEMPLATE(BM_Burst, Global)->Arg(1000)->Arg(100000);
+
+#ifdef SMART_POINTERS_POOLED_BLOCKS
+static const char* kBlocks = "pooled blocks";
+#else
+static const char* kBlocks = "operator new blocks";
+#endif
+
+static void BM_SharedPtrNew(benchmark::State& state) {
+    state.SetLabel(kBlocks);
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        SharedPtr<int> ptr(new int(42));
+        benchmark::DoNotOptimize(ptr);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_MakeShared(benchmark::State& state) {
+    state.SetLabel(kBlocks);
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto ptr = MakeShared<int>(42);
+        benchmark::DoNotOptimize(ptr);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_SharedPtrNew)->ThreadRange(1, 8);
+BENCHMARK(BM_MakeShared)->ThreadRange(1, 8);
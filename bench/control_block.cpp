@@ -0,0 +1,46 @@
+#include "allocation_counters.h"
+#include "perf_counters.h"
+
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+
+// Instructions per copy and destroy. Counting is inline in `ControlBlockBase`, so the only
+// indirect call left is the manual vtable slot run by the last owner.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename Pointer>
+static void BM_CopyDestroy(benchmark::State& state, Pointer ptr) {
+    InstructionsPerOp insns(state);
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        Pointer copy = ptr;
+        benchmark::DoNotOptimize(copy);
+    }
+}
+
+BENCHMARK_CAPTURE(BM_CopyDestroy, ControlBlockPointer, SharedPtr<int>(new int(42)));
+BENCHMARK_CAPTURE(BM_CopyDestroy, ControlBlockHolder, MakeShared<int>(42));
+BENCHMARK_CAPTURE(BM_CopyDestroy, LocalControlBlockHolder, MakeLocalShared<int>(42));
+BENCHMARK_CAPTURE(BM_CopyDestroy, StdSharedPtr, std::make_shared<int>(42));
+
+// The last owner goes away: destroy the object and deallocate the block
+template <typename Factory>
+static void BM_CreateDestroy(benchmark::State& state, Factory factory) {
+    InstructionsPerOp insns(state);
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto ptr = factory();
+        benchmark::DoNotOptimize(ptr);
+    }
+}
+
+BENCHMARK_CAPTURE(BM_CreateDestroy, ControlBlockPointer, [] {
+    return SharedPtr<int>(new int(42));
+});
+BENCHMARK_CAPTURE(BM_CreateDestroy, ControlBlockHolder, [] { return MakeShared<int>(42); });
+BENCHMARK_CAPTURE(BM_CreateDestroy, StdSharedPtr, [] { return std::make_shared<int>(42); });
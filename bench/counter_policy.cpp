@@ -0,0 +1,41 @@
+#include "allocation_counters.h"
+
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+
+// Single-threaded copy/destroy hot path with both counter policies: the difference between
+// `SharedPtr` and `LocalSharedPtr` is the price of the locked RMWs.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename Pointer>
+static void BM_CopyDestroy(benchmark::State& state, Pointer ptr) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        Pointer copy = ptr;
+        benchmark::DoNotOptimize(copy);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename Factory>
+static void BM_MakeDestroy(benchmark::State& state, Factory factory) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto ptr = factory(42);
+        benchmark::DoNotOptimize(ptr);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(BM_CopyDestroy, SharedPtr, MakeShared<int>(42));
+BENCHMARK_CAPTURE(BM_CopyDestroy, LocalSharedPtr, MakeLocalShared<int>(42));
+BENCHMARK_CAPTURE(BM_CopyDestroy, StdSharedPtr, std::make_shared<int>(42));
+
+BENCHMARK_CAPTURE(BM_MakeDestroy, SharedPtr, MakeShared<int, int>);
+BENCHMARK_CAPTURE(BM_MakeDestroy, LocalSharedPtr, MakeLocalShared<int, int>);
+BENCHMARK_CAPTURE(BM_MakeDestroy, StdSharedPtr, std::make_shared<int, int>);
@@ -0,0 +1,80 @@
+#ifndef SMART_POINTERS_CYCLE_COLLECTOR
+#define SMART_POINTERS_CYCLE_COLLECTOR
+#endif
+
+#include "allocation_counters.h"
+
+#include <shared-from-this/shared.h>
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+// Pause of one `CollectCycles` against the number of objects reachable from the candidates. Garbage
+// graphs are traced and destroyed, live ones are traced twice (gray, then black) and stay.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Node {
+    void TraceRefs(CycleTracer& tracer) const {
+        for (const auto& edge : edges) {
+            tracer(edge);
+        }
+    }
+
+    std::vector<SharedPtr<Node>> edges;
+};
+
+// `size` nodes in a ring, each also pointing a few nodes ahead, so that the graph is not a list.
+// The returned node is the only one that is still a candidate.
+static SharedPtr<Node> MakeGraph(size_t size) {
+    std::vector<SharedPtr<Node>> nodes(size);
+    for (auto& node : nodes) {
+        node = MakeShared<Node>();
+    }
+    for (size_t i = 0; i < size; ++i) {
+        nodes[i]->edges.push_back(nodes[(i + 1) % size]);
+        nodes[i]->edges.push_back(nodes[(i + 7) % size]);
+    }
+    SharedPtr<Node> root = nodes[0];
+    nodes.clear();
+    CollectCycles();  // only the releases of the root count
+    return root;
+}
+
+static void BM_CollectGarbage(benchmark::State& state) {
+    CycleCollector::Get().SetCandidateLimit(0);
+    AllocationsPerOp allocs(state, state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        MakeGraph(state.range(0));  // the root is released right away
+        state.ResumeTiming();
+        auto stats = CollectCycles();
+        benchmark::DoNotOptimize(stats);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_CollectLive(benchmark::State& state) {
+    CycleCollector::Get().SetCandidateLimit(0);
+    auto root = MakeGraph(state.range(0));
+    AllocationsPerOp allocs(state, state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto copy = root;
+        copy.Reset();  // makes the root a candidate again
+        state.ResumeTiming();
+        auto stats = CollectCycles();
+        benchmark::DoNotOptimize(stats);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_CollectGarbage)
+    ->RangeMultiplier(10)
+    ->Range(100, 1000000)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_CollectLive)
+    ->RangeMultiplier(10)
+    ->Range(100, 1000000)
+    ->Unit(benchmark::kMicrosecond);
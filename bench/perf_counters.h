@@ -0,0 +1,71 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+
+// Retired user-space instructions of the calling thread, read through perf_event_open(2).
+// Most VMs and containers do not expose the hardware counters, `Valid()` is false there.
+class InstructionCounter {
+public:
+    InstructionCounter() {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    InstructionCounter(const InstructionCounter&) = delete;
+    InstructionCounter& operator=(const InstructionCounter&) = delete;
+
+    ~InstructionCounter() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    bool Valid() const {
+        return fd_ >= 0;
+    }
+
+    uint64_t Read() const {
+        uint64_t value = 0;
+        if (fd_ < 0 || read(fd_, &value, sizeof(value)) != sizeof(value)) {
+            return 0;
+        }
+        return value;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+// Wraps the benchmark loop and reports "insns_per_op" when the counters are available
+class InstructionsPerOp {
+public:
+    explicit InstructionsPerOp(benchmark::State& state) : state_(state), start_(counter_.Read()) {
+    }
+
+    ~InstructionsPerOp() {
+        if (!counter_.Valid()) {
+            state_.SetLabel("no perf counters");
+            return;
+        }
+        state_.counters["insns_per_op"] = benchmark::Counter(
+            static_cast<double>(counter_.Read() - start_), benchmark::Counter::kAvgIterations);
+    }
+
+private:
+    benchmark::State& state_;
+    InstructionCounter counter_;
+    uint64_t start_;
+};
@@ -0,0 +1,147 @@
+#include "allocation_counters.h"
+
+#include <intrusive/intrusive.h>
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+#include <unique/unique.h>
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+// The hot paths of every pointer type next to the std one it replaces: construction, copy, move,
+// destroy, `WeakPtr::Lock`, `MakeShared` against `new`, and `IntrusivePtr` against `SharedPtr`.
+// The `bench` target runs this with JSON output, see bench/CMakeLists.txt.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Object {
+    int value = 42;
+};
+
+struct IntrusiveObject : SimpleRefCounted<IntrusiveObject> {
+    int value = 42;
+};
+
+// Construction and destruction of a pointer owning a fresh object
+template <typename Factory>
+static void BM_Construct(benchmark::State& state, Factory make) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto ptr = make();
+        benchmark::DoNotOptimize(ptr);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(BM_Construct, UniquePtr, [] { return UniquePtr<Object>(new Object); });
+BENCHMARK_CAPTURE(BM_Construct, StdUniquePtr, [] { return std::unique_ptr<Object>(new Object); });
+BENCHMARK_CAPTURE(BM_Construct, SharedPtrNew, [] { return SharedPtr<Object>(new Object); });
+BENCHMARK_CAPTURE(BM_Construct, StdSharedPtrNew, [] {
+    return std::shared_ptr<Object>(new Object);
+});
+BENCHMARK_CAPTURE(BM_Construct, MakeShared, [] { return MakeShared<Object>(); });
+BENCHMARK_CAPTURE(BM_Construct, StdMakeShared, [] { return std::make_shared<Object>(); });
+BENCHMARK_CAPTURE(BM_Construct, MakeLocalShared, [] { return MakeLocalShared<Object>(); });
+BENCHMARK_CAPTURE(BM_Construct, MakeIntrusive, [] { return MakeIntrusive<IntrusiveObject>(); });
+
+// A copy that is destroyed right away, the owner stays
+template <typename Pointer>
+static void BM_Copy(benchmark::State& state, Pointer ptr) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        Pointer copy = ptr;
+        benchmark::DoNotOptimize(copy);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(BM_Copy, SharedPtr, MakeShared<Object>());
+BENCHMARK_CAPTURE(BM_Copy, StdSharedPtr, std::make_shared<Object>());
+BENCHMARK_CAPTURE(BM_Copy, LocalSharedPtr, MakeLocalShared<Object>());
+BENCHMARK_CAPTURE(BM_Copy, IntrusivePtr, MakeIntrusive<IntrusiveObject>());
+
+// Ownership bounces between two pointers, no counter is touched
+template <typename Pointer>
+static void BM_Move(benchmark::State& state, Pointer ptr) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        Pointer other = std::move(ptr);
+        benchmark::DoNotOptimize(other);
+        ptr = std::move(other);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(BM_Move, UniquePtr, UniquePtr<Object>(new Object));
+BENCHMARK_CAPTURE(BM_Move, StdUniquePtr, std::make_unique<Object>());
+BENCHMARK_CAPTURE(BM_Move, SharedPtr, MakeShared<Object>());
+BENCHMARK_CAPTURE(BM_Move, StdSharedPtr, std::make_shared<Object>());
+BENCHMARK_CAPTURE(BM_Move, IntrusivePtr, MakeIntrusive<IntrusiveObject>());
+
+// Only the destruction of the last owners is timed, a batch at a time to keep the pauses cheap
+template <typename Factory>
+static void BM_Destroy(benchmark::State& state, Factory make) {
+    std::vector<decltype(make())> batch;
+    AllocationsPerOp allocs(state, state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            batch.push_back(make());
+        }
+        state.ResumeTiming();
+        batch.clear();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_CAPTURE(BM_Destroy, UniquePtr, [] { return UniquePtr<Object>(new Object); })->Arg(1024);
+BENCHMARK_CAPTURE(BM_Destroy, StdUniquePtr, [] { return std::make_unique<Object>(); })->Arg(1024);
+BENCHMARK_CAPTURE(BM_Destroy, SharedPtr, [] { return MakeShared<Object>(); })->Arg(1024);
+BENCHMARK_CAPTURE(BM_Destroy, StdSharedPtr, [] { return std::make_shared<Object>(); })->Arg(1024);
+BENCHMARK_CAPTURE(BM_Destroy, IntrusivePtr, [] {
+    return MakeIntrusive<IntrusiveObject>();
+})->Arg(1024);
+
+// Promotion of a weak reference while the object is alive and after it died
+template <typename T>
+static WeakPtr<T> Weaken(const SharedPtr<T>& ptr) {
+    return ptr;
+}
+
+template <typename T>
+static std::weak_ptr<T> Weaken(const std::shared_ptr<T>& ptr) {
+    return ptr;
+}
+
+template <typename T>
+static SharedPtr<T> Promote(const WeakPtr<T>& weak) {
+    return weak.Lock();
+}
+
+template <typename T>
+static std::shared_ptr<T> Promote(const std::weak_ptr<T>& weak) {
+    return weak.lock();
+}
+
+template <typename Pointer>
+static void BM_Lock(benchmark::State& state, Pointer ptr) {
+    auto weak = Weaken(ptr);
+    if (state.range(0) == 0) {
+        ptr = Pointer();
+    }
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto locked = Promote(weak);
+        benchmark::DoNotOptimize(locked);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(BM_Lock, WeakPtr, MakeShared<Object>())->ArgName("alive")->Arg(1)->Arg(0);
+BENCHMARK_CAPTURE(BM_Lock, StdWeakPtr, std::make_shared<Object>())
+    ->ArgName("alive")
+    ->Arg(1)
+    ->Arg(0);
@@ -0,0 +1,79 @@
+#include "allocation_counters.h"
+#include "perf_counters.h"
+
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <vector>
+
+// Destroy-heavy loops. The strong references share one implicit weak reference, so a release that
+// is not the last is a single decrement and the sole owner frees the object and block after a load.
+// libstdc++ drops to plain increments while the process has a single thread, run with threads
+// elsewhere or read the std numbers as a lower bound.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Drops `state.range(0)` copies of one pointer, only the last of them is the owner
+template <typename Pointer>
+static void BM_DestroyCopies(benchmark::State& state, Pointer ptr) {
+    std::vector<Pointer> copies;
+    AllocationsPerOp allocs(state, state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        copies.assign(state.range(0), ptr);
+        state.ResumeTiming();
+        copies.clear();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_CAPTURE(BM_DestroyCopies, SharedPtr, MakeShared<int>(42))->Arg(1 << 10);
+BENCHMARK_CAPTURE(BM_DestroyCopies, StdSharedPtr, std::make_shared<int>(42))->Arg(1 << 10);
+
+// The last owner goes away, with or without a weak reference left behind
+template <typename Factory>
+static void BM_DestroyLast(benchmark::State& state, Factory factory) {
+    InstructionsPerOp insns(state);
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto ptr = factory();
+        benchmark::DoNotOptimize(ptr);
+    }
+}
+
+template <typename Factory>
+static void BM_DestroyLastWithWeak(benchmark::State& state, Factory factory) {
+    InstructionsPerOp insns(state);
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto ptr = factory();
+        auto weak = factory.Weak(ptr);
+        benchmark::DoNotOptimize(weak);
+    }
+}
+
+struct MakeSharedFactory {
+    SharedPtr<int> operator()() const {
+        return MakeShared<int>(42);
+    }
+    static WeakPtr<int> Weak(const SharedPtr<int>& ptr) {
+        return ptr;
+    }
+};
+
+struct StdMakeSharedFactory {
+    std::shared_ptr<int> operator()() const {
+        return std::make_shared<int>(42);
+    }
+    static std::weak_ptr<int> Weak(const std::shared_ptr<int>& ptr) {
+        return ptr;
+    }
+};
+
+BENCHMARK_CAPTURE(BM_DestroyLast, SharedPtr, MakeSharedFactory());
+BENCHMARK_CAPTURE(BM_DestroyLast, StdSharedPtr, StdMakeSharedFactory());
+BENCHMARK_CAPTURE(BM_DestroyLastWithWeak, SharedPtr, MakeSharedFactory());
+BENCHMARK_CAPTURE(BM_DestroyLastWithWeak, StdSharedPtr, StdMakeSharedFactory());
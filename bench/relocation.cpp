@@ -0,0 +1,68 @@
+#include "allocation_counters.h"
+
+#include <common/ptr_vector.h>
+#include <intrusive/intrusive.h>
+#include <shared-from-this/shared.h>
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <vector>
+
+// Growing a vector of 10M pointers from empty. The pushes are the same everywhere, one increment
+// of a single block, the growth differs: `std::vector` moves the elements, which it does only
+// because the moves are noexcept (a copy would be two RMWs), `PtrVector` copies bytes.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Counted : SimpleRefCounted<Counted> {};
+
+template <typename Pointer>
+static void BM_StdVectorGrowth(benchmark::State& state, Pointer ptr) {
+    AllocationsPerOp allocs(state, state.range(0));
+    for (auto _ : state) {
+        std::vector<Pointer> vector;
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            vector.push_back(ptr);
+        }
+        benchmark::DoNotOptimize(vector.data());
+        state.PauseTiming();
+        vector = {};  // destroying is not growth
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <typename Pointer>
+static void BM_PtrVectorGrowth(benchmark::State& state, Pointer ptr) {
+    AllocationsPerOp allocs(state, state.range(0));
+    for (auto _ : state) {
+        PtrVector<Pointer> vector;
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            vector.PushBack(ptr);
+        }
+        benchmark::DoNotOptimize(vector.Data());
+        state.PauseTiming();
+        vector = PtrVector<Pointer>();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+constexpr int64_t kPointers = 10'000'000;
+
+BENCHMARK_CAPTURE(BM_StdVectorGrowth, SharedPtr, MakeShared<int>(42))
+    ->Arg(kPointers)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_PtrVectorGrowth, SharedPtr, MakeShared<int>(42))
+    ->Arg(kPointers)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_StdVectorGrowth, StdSharedPtr, std::make_shared<int>(42))
+    ->Arg(kPointers)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_StdVectorGrowth, IntrusivePtr, MakeIntrusive<Counted>())
+    ->Arg(kPointers)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_PtrVectorGrowth, IntrusivePtr, MakeIntrusive<Counted>())
+    ->Arg(kPointers)
+    ->Unit(benchmark::kMillisecond);
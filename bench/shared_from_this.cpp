@@ -0,0 +1,44 @@
+#include "allocation_counters.h"
+
+#include <shared-from-this/shared.h>
+
+#include <benchmark/benchmark.h>
+
+// `EnableSharedFromThis` stores a `WeakPtr` in the object, set up in `MakeShared` with a weak
+// increment and a strong increment and decrement. `EnableSharedFromBlock` stores nothing, the
+// counter `object_bytes` shows the difference in size.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Stored : EnableSharedFromThis<Stored> {
+    int value = 0;
+};
+
+struct FromBlock : EnableSharedFromBlock<FromBlock> {
+    int value = 0;
+};
+
+template <typename Object>
+static void BM_MakeShared(benchmark::State& state) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto object = MakeShared<Object>();
+        benchmark::DoNotOptimize(object.Get());
+    }
+    state.counters["object_bytes"] = sizeof(Object);
+}
+
+template <typename Object>
+static void BM_SharedFromThis(benchmark::State& state) {
+    auto object = MakeShared<Object>();
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto self = object->SharedFromThis();
+        benchmark::DoNotOptimize(self.Get());
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_MakeShared, Stored);
+BENCHMARK_TEMPLATE(BM_MakeShared, FromBlock);
+BENCHMARK_TEMPLATE(BM_SharedFromThis, Stored);
+BENCHMARK_TEMPLATE(BM_SharedFromThis, FromBlock);
@@ -0,0 +1,157 @@
+#include "allocation_counters.h"
+
+#include <shared-from-this/weak_cache.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+// Lookup cache under a skewed key stream. Every lookup that misses creates the value, and the last
+// `kHeld` results are kept alive by a ring of owners, the cache holds only weak references. Reports
+// the hit rate, the p99 latency of one lookup, the entries left in the map and the bytes the thread
+// still has allocated at the end. The baseline never erases: an expired entry is only replaced when
+// its key comes again, until then it pins the value inside the block of `std::make_shared`.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static constexpr int64_t kKeys = 1 << 20;
+static constexpr size_t kHeld = 1 << 14;
+static constexpr int64_t kLookups = 1 << 16;  // per iteration
+
+struct Value {
+    char payload[64] = {};
+};
+
+struct Ours {
+    using Ptr = SharedPtr<Value>;
+
+    Ptr Get(int64_t key, bool& hit) {
+        hit = true;
+        return cache.FindOrCreate(key, [&hit] {
+            hit = false;
+            return MakeShared<Value>();
+        });
+    }
+    size_t Size() {
+        return cache.Size();
+    }
+
+    WeakValueCache<int64_t, Value> cache;
+};
+
+struct Sharded {
+    using Ptr = SharedPtr<Value>;
+
+    Ptr Get(int64_t key, bool& hit) {
+        hit = true;
+        return cache.FindOrCreate(key, [&hit] {
+            hit = false;
+            return MakeShared<Value>();
+        });
+    }
+    size_t Size() {
+        return cache.Size();
+    }
+
+    ShardedWeakValueCache<int64_t, Value> cache;
+};
+
+struct Std {
+    using Ptr = std::shared_ptr<Value>;
+
+    Ptr Get(int64_t key, bool& hit) {
+        std::weak_ptr<Value>& slot = map[key];
+        if (Ptr value = slot.lock()) {
+            hit = true;
+            return value;
+        }
+        hit = false;
+        Ptr value = std::make_shared<Value>();
+        slot = value;
+        return value;
+    }
+    size_t Size() {
+        return map.size();
+    }
+
+    std::unordered_map<int64_t, std::weak_ptr<Value>> map;
+};
+
+// Shared by the threads of one run, made fresh for every run
+template <typename Cache>
+static Cache* cache = nullptr;
+
+template <typename Cache>
+static void NewCache(const benchmark::State&) {
+    cache<Cache> = new Cache();
+}
+
+template <typename Cache>
+static void DeleteCache(const benchmark::State&) {
+    delete cache<Cache>;
+}
+
+template <typename Cache>
+static void BM_Lookup(benchmark::State& state) {
+    std::vector<typename Cache::Ptr> held(kHeld);
+    std::vector<int64_t> latencies;
+    latencies.reserve(state.max_iterations * kLookups);
+    int64_t live_bytes = alloc_checker::ThreadStats().live_bytes;
+    std::mt19937_64 random(state.thread_index());
+    std::uniform_real_distribution<double> exponent(0, std::log2(kKeys));
+    size_t next = 0;
+    int64_t hits = 0;
+
+    for (auto _ : state) {
+        for (int64_t i = 0; i < kLookups; ++i) {
+            int64_t key = std::exp2(exponent(random)) - 1;  // log-uniform, small keys are hot
+            bool hit = false;
+            auto start = std::chrono::steady_clock::now();
+            auto value = cache<Cache>->Get(key, hit);
+            auto stop = std::chrono::steady_clock::now();
+            latencies.push_back(std::chrono::nanoseconds(stop - start).count());
+            hits += hit;
+            held[next++ % kHeld] = std::move(value);
+        }
+    }
+
+    auto p99 = latencies.begin() + latencies.size() * 99 / 100;
+    std::nth_element(latencies.begin(), p99, latencies.end());
+    double lookups = static_cast<double>(state.iterations() * kLookups);
+    state.counters["hit_rate"] =
+        benchmark::Counter(hits / lookups, benchmark::Counter::kAvgThreads);
+    state.counters["p99_ns"] = benchmark::Counter(*p99, benchmark::Counter::kAvgThreads);
+    state.SetItemsProcessed(state.iterations() * kLookups);
+    if (state.thread_index() == 0) {
+        state.counters["entries"] = cache<Cache>->Size();
+        // Meaningful single-threaded only, the other threads free into their own counters
+        state.counters["live_MiB"] =
+            (alloc_checker::ThreadStats().live_bytes - live_bytes) / double(1 << 20);
+    }
+    held.clear();
+}
+
+BENCHMARK_TEMPLATE(BM_Lookup, Ours)
+    ->Setup(NewCache<Ours>)
+    ->Teardown(DeleteCache<Ours>)
+    ->Iterations(64)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Lookup, Std)
+    ->Setup(NewCache<Std>)
+    ->Teardown(DeleteCache<Std>)
+    ->Iterations(64)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Lookup, Sharded)
+    ->Setup(NewCache<Sharded>)
+    ->Teardown(DeleteCache<Sharded>)
+    ->Iterations(64)
+    ->ThreadRange(1, 4)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,65 @@
+#include "allocation_counters.h"
+
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+
+#include <benchmark/benchmark.h>
+
+// Promotion of a `WeakPtr`. `LockWithCheck` is how `Lock` used to work: a load for `Expired`, then
+// the throwing constructor with its own CAS loop inside a try block. `TryLock` is the CAS loop
+// alone. The threads share one object, so the increments contend.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+static SharedPtr<T> LockWithCheck(const WeakPtr<T>& weak) {
+    if (weak.Expired()) {
+        return SharedPtr<T>();
+    }
+    try {
+        return SharedPtr<T>(weak);
+    } catch (const BadWeakPtr&) {
+        return SharedPtr<T>();
+    }
+}
+
+static SharedPtr<int> owner = MakeShared<int>(42);
+static WeakPtr<int> live = owner;
+static WeakPtr<int> expired = MakeShared<int>(42);
+
+static void BM_LockWithCheck(benchmark::State& state) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto locked = LockWithCheck(live);
+        benchmark::DoNotOptimize(locked.Get());
+    }
+}
+
+static void BM_TryLock(benchmark::State& state) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto locked = live.TryLock();
+        benchmark::DoNotOptimize(locked.Get());
+    }
+}
+
+static void BM_LockWithCheckExpired(benchmark::State& state) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto locked = LockWithCheck(expired);
+        benchmark::DoNotOptimize(locked.Get());
+    }
+}
+
+static void BM_TryLockExpired(benchmark::State& state) {
+    AllocationsPerOp allocs(state);
+    for (auto _ : state) {
+        auto locked = expired.TryLock();
+        benchmark::DoNotOptimize(locked.Get());
+    }
+}
+
+BENCHMARK(BM_LockWithCheck)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_TryLock)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_LockWithCheckExpired);
+BENCHMARK(BM_TryLockExpired);
@@ -0,0 +1,86 @@
+#include "allocation_counters.h"
+
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+
+#include <benchmark/benchmark.h>
+
+#include <malloc.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+// Weak-heavy cache: entries of 4 KiB are created, a weak reference to each is kept and the strong
+// one dropped right away. Reports how much the resident set grew over the run, which is its peak
+// here since nothing is released before the end. With separate object storage the weak references
+// pin only the blocks, inline storage and std::make_shared pin every entry.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static constexpr size_t kEntrySize = 4096;
+
+struct Entry {
+    char payload[kEntrySize];
+};
+
+struct InlineEntry {
+    char payload[kEntrySize];
+};
+
+template <>
+inline constexpr bool kSeparateObjectStorage<InlineEntry> = false;
+
+static long ResidentKiB() {
+    long pages = 0;
+    long resident = 0;
+    if (FILE* statm = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        std::fclose(statm);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+template <typename T>
+static WeakPtr<T> Weaken(const SharedPtr<T>& ptr) {
+    return ptr;
+}
+
+template <typename T>
+static std::weak_ptr<T> Weaken(const std::shared_ptr<T>& ptr) {
+    return ptr;
+}
+
+template <typename Factory>
+static void BM_WeakCache(benchmark::State& state, Factory make) {
+    long growth = 0;
+    AllocationsPerOp allocs(state, state.range(0));
+    for (auto _ : state) {
+        malloc_trim(0);
+        long before = ResidentKiB();
+        std::vector<decltype(Weaken(make()))> cache;
+        cache.reserve(state.range(0));
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            auto entry = make();
+            entry->payload[0] = static_cast<char>(i);
+            cache.push_back(Weaken(entry));
+        }
+        growth = std::max(growth, ResidentKiB() - before);
+    }
+    state.counters["rss_growth_kib"] = static_cast<double>(growth);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_CAPTURE(BM_WeakCache, SeparateStorage, [] {
+    return MakeShared<Entry>();
+})->Arg(10000)->Iterations(3);
+BENCHMARK_CAPTURE(BM_WeakCache, InlineStorage, [] {
+    return MakeShared<InlineEntry>();
+})->Arg(10000)->Iterations(3);
+BENCHMARK_CAPTURE(BM_WeakCache, StdMakeShared, [] {
+    return std::make_shared<Entry>();
+})->Arg(10000)->Iterations(3);
@@ -0,0 +1,242 @@
+#include "allocations_checker.h"
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdlib>
+#include <new>
+
+namespace alloc_checker {
+
+namespace {
+
+// Written only by the owner thread, the atomics let `GlobalStats` read them at any time. Records
+// come from malloc, so that creating one never recurses into the hooks, and are never freed.
+struct Record {
+    std::atomic<size_t> allocations = 0;
+    std::atomic<size_t> deallocations = 0;
+    std::atomic<size_t> allocated_bytes = 0;
+    std::atomic<int64_t> live_bytes = 0;
+    std::atomic<int64_t> peak_live_bytes = 0;
+    std::array<std::atomic<size_t>, kHistogramBuckets> histogram = {};
+    Record* next = nullptr;
+};
+
+std::atomic<Record*> records = nullptr;
+
+template <typename T>
+void Bump(std::atomic<T>& counter, T delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+Record& ThreadRecord() {
+    thread_local Record* record = nullptr;  // constant-initialized, no guard and no destructor
+    if (!record) {
+        void* memory = std::malloc(sizeof(Record));
+        if (!memory) {
+            std::abort();
+        }
+        record = new (memory) Record();
+        record->next = records.load(std::memory_order_relaxed);
+        while (!records.compare_exchange_weak(record->next, record, std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+        }
+    }
+    return *record;
+}
+
+Stats Read(const Record& record) {
+    Stats stats;
+    stats.allocations = record.allocations.load(std::memory_order_relaxed);
+    stats.deallocations = record.deallocations.load(std::memory_order_relaxed);
+    stats.allocated_bytes = record.allocated_bytes.load(std::memory_order_relaxed);
+    stats.live_bytes = record.live_bytes.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < kHistogramBuckets; ++i) {
+        stats.histogram[i] = record.histogram[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void OnAllocate(void* ptr, size_t size) {
+    Record& record = ThreadRecord();
+    Bump<size_t>(record.allocations, 1);
+    Bump(record.allocated_bytes, size);
+    Bump<size_t>(record.histogram[HistogramBucket(size)], 1);
+    Bump<int64_t>(record.live_bytes, malloc_usable_size(ptr));
+    int64_t live = record.live_bytes.load(std::memory_order_relaxed);
+    if (live > record.peak_live_bytes.load(std::memory_order_relaxed)) {
+        record.peak_live_bytes.store(live, std::memory_order_relaxed);
+    }
+}
+
+void OnDeallocate(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    Record& record = ThreadRecord();
+    Bump<size_t>(record.deallocations, 1);
+    Bump<int64_t>(record.live_bytes, -static_cast<int64_t>(malloc_usable_size(ptr)));
+}
+
+void* Allocate(size_t size) {
+    void* ptr = std::malloc(size ? size : 1);
+    if (ptr) {
+        OnAllocate(ptr, size);
+    }
+    return ptr;
+}
+
+void* AllocateAligned(size_t size, std::align_val_t alignment) {
+    auto align = static_cast<size_t>(alignment);
+    // aligned_alloc wants a multiple of the alignment
+    void* ptr = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align);
+    if (ptr) {
+        OnAllocate(ptr, size);
+    }
+    return ptr;
+}
+
+void Deallocate(void* ptr) {
+    OnDeallocate(ptr);
+    std::free(ptr);
+}
+
+}  // namespace
+
+Stats Stats::operator-(const Stats& other) const {
+    Stats result;
+    result.allocations = allocations - other.allocations;
+    result.deallocations = deallocations - other.deallocations;
+    result.allocated_bytes = allocated_bytes - other.allocated_bytes;
+    result.live_bytes = live_bytes - other.live_bytes;
+    for (size_t i = 0; i < kHistogramBuckets; ++i) {
+        result.histogram[i] = histogram[i] - other.histogram[i];
+    }
+    return result;
+}
+
+size_t HistogramBucket(size_t size) {
+    return std::min<size_t>(size <= 1 ? 0 : std::bit_width(size - 1), kHistogramBuckets - 1);
+}
+
+Stats ThreadStats() {
+    return Read(ThreadRecord());
+}
+
+Stats GlobalStats() {
+    Stats total;
+    for (Record* record = records.load(std::memory_order_acquire); record; record = record->next) {
+        Stats stats = Read(*record);
+        total.allocations += stats.allocations;
+        total.deallocations += stats.deallocations;
+        total.allocated_bytes += stats.allocated_bytes;
+        total.live_bytes += stats.live_bytes;
+        for (size_t i = 0; i < kHistogramBuckets; ++i) {
+            total.histogram[i] += stats.histogram[i];
+        }
+    }
+    return total;
+}
+
+int64_t ThreadPeakLiveBytes() {
+    return ThreadRecord().peak_live_bytes.load(std::memory_order_relaxed);
+}
+
+void ResetThreadPeak() {
+    Record& record = ThreadRecord();
+    record.peak_live_bytes.store(record.live_bytes.load(std::memory_order_relaxed),
+                                 std::memory_order_relaxed);
+}
+
+}  // namespace alloc_checker
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Replacements of the global operators
+
+void* operator new(size_t size) {
+    if (void* ptr = alloc_checker::Allocate(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return ::operator new(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    if (void* ptr = alloc_checker::AllocateAligned(size, alignment)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return ::operator new(size, alignment);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return alloc_checker::Allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return alloc_checker::Allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return alloc_checker::AllocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return alloc_checker::AllocateAligned(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept {
+    alloc_checker::Deallocate(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    alloc_checker::Deallocate(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    alloc_checker::Deallocate(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    alloc_checker::Deallocate(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    alloc_checker::Deallocate(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    alloc_checker::Deallocate(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    alloc_checker::Deallocate(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+    alloc_checker::Deallocate(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    alloc_checker::Deallocate(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    alloc_checker::Deallocate(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    alloc_checker::Deallocate(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    alloc_checker::Deallocate(ptr);
+}
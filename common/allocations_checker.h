@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Accounting of the global `operator new` and `operator delete`. The replacement operators are in
+// allocations_checker.cpp, link it into the binary to turn the hooks on. Every thread counts into
+// its own record with plain stores, `GlobalStats` adds the records of all threads up.
+//
+// A deallocation is charged to the thread that frees, so the live bytes of one thread may go below
+// zero when its objects are destroyed elsewhere.
+namespace alloc_checker {
+
+inline constexpr size_t kHistogramBuckets = 32;
+
+struct Stats {
+    size_t allocations = 0;
+    size_t deallocations = 0;
+    size_t allocated_bytes = 0;  // as requested
+    int64_t live_bytes = 0;      // usable size of the allocated blocks minus the freed ones
+    // Allocations by requested size: bucket i holds the sizes in (2^(i-1), 2^i], the last one also
+    // everything above
+    std::array<size_t, kHistogramBuckets> histogram = {};
+
+    Stats operator-(const Stats& other) const;
+};
+
+size_t HistogramBucket(size_t size);
+
+// Counters of the calling thread
+Stats ThreadStats();
+
+// Counters of all threads that ever allocated, including the ones that exited
+Stats GlobalStats();
+
+// Highest `live_bytes` of the calling thread since the last `ResetThreadPeak`
+int64_t ThreadPeakLiveBytes();
+void ResetThreadPeak();
+
+// What the calling thread allocated since construction
+class AllocationScope {
+public:
+    AllocationScope() : start_(ThreadStats()) {
+    }
+
+    Stats Delta() const {
+        return ThreadStats() - start_;
+    }
+
+private:
+    Stats start_;
+};
+
+}  // namespace alloc_checker
+
+// Scoped assertions for Catch tests: run the statements and check what the calling thread
+// allocated meanwhile
+
+#define EXPECT_ALLOCATIONS(count, ...)                             \
+    do {                                                           \
+        alloc_checker::AllocationScope allocation_scope_;          \
+        __VA_ARGS__;                                               \
+        REQUIRE(allocation_scope_.Delta().allocations == (count)); \
+    } while (false)
+
+#define EXPECT_ZERO_ALLOCATIONS(...) EXPECT_ALLOCATIONS(0, __VA_ARGS__)
+#define EXPECT_ONE_ALLOCATION(...) EXPECT_ALLOCATIONS(1, __VA_ARGS__)
+
+#define EXPECT_ALLOCATED_BYTES(bytes, ...)                             \
+    do {                                                               \
+        alloc_checker::AllocationScope allocation_scope_;              \
+        __VA_ARGS__;                                                   \
+        REQUIRE(allocation_scope_.Delta().allocated_bytes == (bytes)); \
+    } while (false)
+
+// Everything the statements allocated is freed once they and their locals are gone
+#define EXPECT_NO_LEAKS(...)                                                       \
+    do {                                                                           \
+        alloc_checker::AllocationScope allocation_scope_;                          \
+        {                                                                          \
+            __VA_ARGS__;                                                           \
+        }                                                                          \
+        alloc_checker::Stats allocation_delta_ = allocation_scope_.Delta();        \
+        REQUIRE(allocation_delta_.deallocations == allocation_delta_.allocations); \
+        REQUIRE(allocation_delta_.live_bytes == 0);                                \
+    } while (false)
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Slab allocator for control blocks, used by `ControlBlockBase::operator new` when the library is
+// built with SMART_POINTERS_POOLED_BLOCKS. Sizes are rounded up to classes of 16 bytes, larger
+// requests go to the global `operator new`. Every thread keeps a free list per class and trades
+// blocks with the global depot in batches, so a block freed by another thread simply joins the
+// cache of that thread. Slabs are never given back to the system.
+class BlockPool {
+public:
+    static constexpr size_t kGranularity = 16;  // also the alignment of every block
+    static constexpr size_t kMaxSize = 256;
+    static constexpr size_t kClasses = kMaxSize / kGranularity;
+    static constexpr size_t kBatch = 32;  // blocks moved between a thread cache and the depot
+    static constexpr size_t kSlabSize = 64 * 1024;
+
+    static void* Allocate(size_t size) {
+        if (size > kMaxSize) {
+            return ::operator new(size);
+        }
+        size_t size_class = ClassOf(size);
+        if (ThreadCache* cache = ThreadCache::Current()) {
+            return cache->Allocate(size_class);
+        }
+        return ::operator new(ClassSize(size_class));  // the thread cache is already destroyed
+    }
+
+    static void Deallocate(void* ptr, size_t size) {
+        if (size > kMaxSize) {
+            ::operator delete(ptr);
+            return;
+        }
+        size_t size_class = ClassOf(size);
+        if (ThreadCache* cache = ThreadCache::Current()) {
+            cache->Deallocate(ptr, size_class);
+        } else {
+            auto block = static_cast<FreeBlock*>(ptr);
+            block->next = nullptr;
+            Depot::Get().Push(size_class, {block, 1});
+        }
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct FreeList {
+        FreeBlock* head = nullptr;
+        size_t count = 0;
+    };
+
+    static size_t ClassOf(size_t size) {
+        return size == 0 ? 0 : (size - 1) / kGranularity;
+    }
+
+    static size_t ClassSize(size_t size_class) {
+        return (size_class + 1) * kGranularity;
+    }
+
+    // Shared by all threads, one lock per size class. Never destroyed, so that thread caches may
+    // flush into it at exit and the slabs stay reachable.
+    class Depot {
+    public:
+        static Depot& Get() {
+            static Depot* depot = new Depot();
+            return *depot;
+        }
+
+        void Push(size_t size_class, FreeList list) {
+            std::lock_guard lock(classes_[size_class].mutex);
+            classes_[size_class].lists.push_back(list);
+        }
+
+        FreeList Pop(size_t size_class) {
+            Class& c = classes_[size_class];
+            std::lock_guard lock(c.mutex);
+            if (c.lists.empty()) {
+                Carve(size_class, c);
+            }
+            FreeList list = c.lists.back();
+            c.lists.pop_back();
+            return list;
+        }
+
+    private:
+        struct Class {
+            std::mutex mutex;
+            std::vector<FreeList> lists;
+        };
+
+        // Cuts a fresh slab into batches of blocks of one class
+        void Carve(size_t size_class, Class& c) {
+            size_t block_size = ClassSize(size_class);
+            char* slab = static_cast<char*>(::operator new(kSlabSize));
+            {
+                std::lock_guard lock(slabs_mutex_);
+                slabs_.push_back(slab);
+            }
+            FreeList list;
+            for (size_t offset = 0; offset + block_size <= kSlabSize; offset += block_size) {
+                auto block = reinterpret_cast<FreeBlock*>(slab + offset);
+                block->next = list.head;
+                list.head = block;
+                if (++list.count == kBatch) {
+                    c.lists.push_back(list);
+                    list = FreeList();
+                }
+            }
+            if (list.count) {
+                c.lists.push_back(list);
+            }
+        }
+
+        Class classes_[kClasses];
+        std::mutex slabs_mutex_;
+        std::vector<char*> slabs_;
+    };
+
+    class ThreadCache {
+    public:
+        // nullptr once the cache of this thread has been destroyed
+        static ThreadCache* Current() {
+            thread_local bool exited = false;
+            if (exited) {
+                return nullptr;
+            }
+            thread_local ThreadCache cache(&exited);
+            return &cache;
+        }
+
+        explicit ThreadCache(bool* exited) : exited_(exited) {
+        }
+
+        ThreadCache(const ThreadCache&) = delete;
+        ThreadCache& operator=(const ThreadCache&) = delete;
+
+        ~ThreadCache() {
+            *exited_ = true;
+            for (size_t size_class = 0; size_class < kClasses; ++size_class) {
+                if (lists_[size_class].count) {
+                    Depot::Get().Push(size_class, lists_[size_class]);
+                }
+            }
+        }
+
+        void* Allocate(size_t size_class) {
+            FreeList& list = lists_[size_class];
+            if (!list.head) {
+                list = Depot::Get().Pop(size_class);
+            }
+            FreeBlock* block = list.head;
+            list.head = block->next;
+            --list.count;
+            return block;
+        }
+
+        // Keeps up to two batches, then hands one back to the depot
+        void Deallocate(void* ptr, size_t size_class) {
+            FreeList& list = lists_[size_class];
+            auto block = static_cast<FreeBlock*>(ptr);
+            block->next = list.head;
+            list.head = block;
+            if (++list.count < 2 * kBatch) {
+                return;
+            }
+            FreeList batch{list.head, kBatch};
+            FreeBlock* last = list.head;
+            for (size_t i = 1; i < kBatch; ++i) {
+                last = last->next;
+            }
+            list.head = last->next;
+            list.count -= kBatch;
+            last->next = nullptr;
+            Depot::Get().Push(size_class, batch);
+        }
+
+    private:
+        FreeList lists_[kClasses];
+        bool* exited_;
+    };
+};
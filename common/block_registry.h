@@ -0,0 +1,180 @@
+#pragma once
+
+// Registry of the live control blocks of `SharedPtr`, compiled in only when the library is built
+// with SMART_POINTERS_BLOCK_REGISTRY. Every block links itself into one of `kShards` lists, picked
+// by its address, when it is created and unlinks when it is freed. `LiveBlocks` and `Report` list
+// what is still there: type, object size, counts and the call stack that created the block.
+//
+// The creation site is a raw backtrace, no symbols are looked up until a report is made. Link with
+// -rdynamic to get function names instead of offsets, or feed the offsets to addr2line.
+#ifdef SMART_POINTERS_BLOCK_REGISTRY
+
+#include <cxxabi.h>
+#include <execinfo.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+namespace block_registry {
+
+inline constexpr size_t kShards = 16;
+inline constexpr int kSiteFrames = 10;  // the block constructors come first
+
+// Per type of the managed object. Arrays report the size of one element.
+struct TypeInfo {
+    const std::type_info& (*type)();
+    size_t size;
+};
+
+template <typename T>
+const std::type_info& TypeOf() {
+    return typeid(T);
+}
+
+template <typename T>
+inline constexpr TypeInfo kTypeInfo{&TypeOf<T>, sizeof(std::remove_extent_t<T>)};
+
+// Embedded into every control block
+struct Node {
+    Node* prev = nullptr;
+    Node* next = nullptr;
+    const void* block = nullptr;
+    const TypeInfo* info = nullptr;
+    void (*read_counts)(const void* block, size_t& strong, size_t& weak) = nullptr;
+    void* site[kSiteFrames];
+    int site_frames = 0;
+};
+
+struct LiveBlock {
+    const void* block;
+    std::string type;
+    size_t size;
+    size_t strong;  // 0 if the object is destroyed and only weak references keep the block
+    size_t weak;
+    std::vector<std::string> site;  // innermost frame first
+};
+
+class Registry {
+public:
+    static Registry& Get() {
+        static Registry* registry = new Registry();  // blocks may be freed after static destructors
+        return *registry;
+    }
+
+    // Not inlined, so that exactly one frame, its own, is left out of the site
+    [[gnu::noinline]] void Add(Node* node) {
+        void* frames[kSiteFrames + 1];
+        int count = backtrace(frames, kSiteFrames + 1);
+        for (int i = 1; i < count; ++i) {
+            node->site[node->site_frames++] = frames[i];
+        }
+
+        Shard& shard = ShardOf(node);
+        std::lock_guard lock(shard.mutex);
+        node->prev = nullptr;
+        node->next = shard.head;
+        if (shard.head) {
+            shard.head->prev = node;
+        }
+        shard.head = node;
+    }
+
+    void Remove(Node* node) {
+        Shard& shard = ShardOf(node);
+        std::lock_guard lock(shard.mutex);
+        if (node->prev) {
+            node->prev->next = node->next;
+        } else {
+            shard.head = node->next;
+        }
+        if (node->next) {
+            node->next->prev = node->prev;
+        }
+    }
+
+    std::vector<LiveBlock> LiveBlocks() {
+        std::vector<LiveBlock> result;
+        for (Shard& shard : shards_) {
+            std::lock_guard lock(shard.mutex);
+            for (Node* node = shard.head; node; node = node->next) {
+                LiveBlock live{node->block, Demangle(node->info->type().name()), node->info->size,
+                               0, 0, {}};
+                node->read_counts(node->block, live.strong, live.weak);
+                char** symbols = backtrace_symbols(node->site, node->site_frames);
+                for (int i = 0; symbols && i < node->site_frames; ++i) {
+                    live.site.emplace_back(symbols[i]);
+                }
+                std::free(symbols);
+                result.push_back(std::move(live));
+            }
+        }
+        return result;
+    }
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        Node* head = nullptr;
+    };
+
+    Registry() = default;
+
+    Shard& ShardOf(const Node* node) {
+        return shards_[(reinterpret_cast<uintptr_t>(node) >> 6) % kShards];
+    }
+
+    static std::string Demangle(const char* name) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        if (status != 0) {
+            return name;
+        }
+        std::string result(demangled);
+        std::free(demangled);
+        return result;
+    }
+
+    Shard shards_[kShards];
+};
+
+inline std::vector<LiveBlock> LiveBlocks() {
+    return Registry::Get().LiveBlocks();
+}
+
+// Human-readable list of the live blocks, empty if there are none
+inline std::string Report() {
+    std::vector<LiveBlock> blocks = LiveBlocks();
+    std::ostringstream out;
+    if (!blocks.empty()) {
+        out << blocks.size() << " live control block(s)\n";
+    }
+    for (const LiveBlock& live : blocks) {
+        out << live.type << " (" << live.size << " bytes) at " << live.block << ": strong "
+            << live.strong << ", weak " << live.weak << "\n";
+        for (const std::string& frame : live.site) {
+            out << "    " << frame << "\n";
+        }
+    }
+    return out.str();
+}
+
+// Prints `Report` to stderr at exit if anything is still alive. Objects owned by static variables
+// may be reported as well, they are only released after the handler runs.
+inline void ReportAtExit() {
+    static const int registered = std::atexit([] {
+        std::string report = Report();
+        std::fputs(report.c_str(), stderr);
+    });
+    (void)registered;
+}
+
+}  // namespace block_registry
+
+#endif
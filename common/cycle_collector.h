@@ -0,0 +1,246 @@
+#pragma once
+
+// Synchronous cycle collector for `SharedPtr` object graphs (Bacon and Rajan, "Concurrent Cycle
+// Collection in Reference Counted Systems", ECOOP'01, the synchronous variant), compiled in only
+// when the library is built with SMART_POINTERS_CYCLE_COLLECTOR.
+//
+// Only objects of types with a `void TraceRefs(CycleTracer&) const` member take part, it passes
+// every `SharedPtr` member to the tracer. A release that leaves such an object alive makes it a
+// candidate root of a garbage cycle. `Collect` runs trial deletion from the candidates on side
+// counters: it subtracts the references inside the traced subgraph, whatever is left without
+// references from outside is a garbage cycle and is destroyed. The blocks stay untouched, so they
+// carry no color bits.
+//
+// `Collect` must not run while other threads change the traced graphs. It runs on demand, and from
+// the release that fills the candidate buffer only after `SetCandidateLimit`, which is safe for
+// single-threaded programs alone: that release may come from any thread. Collections of different
+// threads take turns.
+#ifdef SMART_POINTERS_CYCLE_COLLECTOR
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace cycle_collector {
+
+// Manual collection only, the buffer grows until `Collect`
+inline constexpr size_t kDefaultCandidateLimit = 0;
+
+struct Stats {
+    size_t candidates = 0;  // roots examined
+    size_t traced = 0;      // blocks in the subgraphs of the roots
+    size_t collected = 0;   // objects destroyed
+};
+
+// `Block` is `ControlBlockBase`, it befriends the collector for `IsTraced`, `TraceChildren`,
+// `DestroyObject` and `ReleaseDestroyed`
+template <typename Block>
+class Collector {
+public:
+    static Collector& Get() {
+        static Collector* collector = new Collector();  // blocks may be released at exit
+        return *collector;
+    }
+
+    // Takes over a weak reference of `block`, which keeps it allocated until the next `Collect`
+    void AddCandidate(Block* block) {
+        bool full = false;
+        if (!Collecting()) {
+            std::lock_guard lock(mutex_);
+            if (candidates_.insert(block).second) {
+                full = limit_ && candidates_.size() >= limit_;
+                block = nullptr;
+            }
+        }
+        if (block) {  // already a candidate, or released by the collection itself
+            ReleaseWeak(block);
+        } else if (full) {
+            Collect();
+        }
+    }
+
+    Stats Collect() {
+        if (Collecting()) {
+            return {};
+        }
+        std::lock_guard collect_lock(collect_mutex_);
+        Collecting() = true;
+        std::unordered_set<Block*> candidates;
+        {
+            std::lock_guard lock(mutex_);
+            candidates.swap(candidates_);
+        }
+        std::vector<Block*> roots(candidates.begin(), candidates.end());
+
+        Stats stats;
+        stats.candidates = roots.size();
+        for (Block* root : roots) {
+            if (root->GetStrongRefCount() != 0) {
+                MarkGray(root);
+            }
+        }
+        for (Block* root : roots) {
+            if (root->GetStrongRefCount() != 0) {
+                Scan(root);
+            }
+        }
+        stats.traced = nodes_.size();
+
+        std::vector<Block*> garbage;
+        for (auto& [block, node] : nodes_) {
+            if (node.color == Color::kWhite) {
+                garbage.push_back(block);
+            }
+        }
+        decltype(nodes_)().swap(nodes_);
+        // The references inside the cycles go away with the objects, the extra one keeps the
+        // counts above zero meanwhile, so no object is destroyed twice
+        for (Block* block : garbage) {
+            block->IncStrongRef();
+        }
+        for (Block* block : garbage) {
+            block->DestroyObject();
+        }
+        for (Block* block : garbage) {
+            if (block->ReleaseDestroyed()) {
+                block->DeallocateBlock();
+            }
+        }
+        for (Block* root : roots) {
+            ReleaseWeak(root);
+        }
+        stats.collected = garbage.size();
+        Collecting() = false;
+        return stats;
+    }
+
+    // Collect automatically once this many candidates are buffered, 0 turns that off
+    void SetCandidateLimit(size_t limit) {
+        std::lock_guard lock(mutex_);
+        limit_ = limit;
+    }
+
+    size_t Candidates() {
+        std::lock_guard lock(mutex_);
+        return candidates_.size();
+    }
+
+private:
+    enum class Color { kBlack, kGray, kWhite };
+
+    struct Node {
+        size_t count;  // strong count minus the references from gray objects
+        Color color;
+    };
+
+    Collector() = default;
+
+    static bool& Collecting() {
+        thread_local bool collecting = false;
+        return collecting;
+    }
+
+    static void ReleaseWeak(Block* block) {
+        if (block->DecWeakRef()) {
+            block->DeallocateBlock();
+        }
+    }
+
+    Node& NodeOf(Block* block) {
+        auto [it, inserted] = nodes_.try_emplace(block);
+        if (inserted) {
+            it->second = {block->GetStrongRefCount(), Color::kBlack};
+        }
+        return it->second;
+    }
+
+    // Traced children of `block` in `children_`. A child without strong references is being
+    // destroyed by another release, it is neither garbage nor counted.
+    void Children(Block* block) {
+        children_.clear();
+        Block::TraceChildren(block, children_);
+        std::erase_if(children_, [](Block* child) {
+            return !Block::IsTraced(child) || child->GetStrongRefCount() == 0;
+        });
+    }
+
+    // Subtracts the references inside the subgraph of `root`. Iterative, graphs may be deep.
+    void MarkGray(Block* root) {
+        Node& node = NodeOf(root);
+        if (node.color == Color::kGray) {
+            return;
+        }
+        node.color = Color::kGray;
+        stack_.push_back(root);
+        while (!stack_.empty()) {
+            Block* block = stack_.back();
+            stack_.pop_back();
+            Children(block);
+            for (Block* child : children_) {
+                Node& child_node = NodeOf(child);
+                --child_node.count;
+                if (child_node.color != Color::kGray) {
+                    child_node.color = Color::kGray;
+                    stack_.push_back(child);
+                }
+            }
+        }
+    }
+
+    // Gray objects with references left are alive, so is everything they reach. The rest is white.
+    void Scan(Block* root) {
+        stack_.push_back(root);
+        while (!stack_.empty()) {
+            Block* block = stack_.back();
+            stack_.pop_back();
+            Node& node = nodes_.at(block);
+            if (node.color != Color::kGray) {
+                continue;
+            }
+            if (node.count > 0) {
+                ScanBlack(block);
+                continue;
+            }
+            node.color = Color::kWhite;
+            Children(block);
+            stack_.insert(stack_.end(), children_.begin(), children_.end());
+        }
+    }
+
+    // Gives the references back to everything reachable from `root`
+    void ScanBlack(Block* root) {
+        std::vector<Block*> stack{root};
+        nodes_.at(root).color = Color::kBlack;
+        while (!stack.empty()) {
+            Block* block = stack.back();
+            stack.pop_back();
+            Children(block);
+            for (Block* child : children_) {
+                Node& child_node = nodes_.at(child);
+                ++child_node.count;
+                if (child_node.color != Color::kBlack) {
+                    child_node.color = Color::kBlack;
+                    stack.push_back(child);
+                }
+            }
+        }
+    }
+
+    // Both are emptied by swapping, `clear` would keep the buckets and visit all of them the next
+    // time, so one large collection would slow down every later one
+    std::mutex mutex_;
+    std::unordered_set<Block*> candidates_;
+    size_t limit_ = kDefaultCandidateLimit;
+
+    // Scratch space of `Collect`, under `collect_mutex_`
+    std::mutex collect_mutex_;
+    std::unordered_map<Block*, Node> nodes_;
+    std::vector<Block*> stack_;
+    std::vector<Block*> children_;
+};
+
+}  // namespace cycle_collector
+
+#endif
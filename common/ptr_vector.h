@@ -0,0 +1,155 @@
+#pragma once
+
+#include "relocate.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Growable array that moves its elements with `Relocate`, so a growing `PtrVector<SharedPtr<T>>`
+// copies bytes instead of touching any reference count. Same growth as `std::vector` in
+// libstdc++: the capacity doubles.
+template <typename T>
+class PtrVector {
+public:
+    PtrVector() = default;
+
+    PtrVector(const PtrVector& other) {
+        Reserve(other.size_);
+        try {
+            for (; size_ < other.size_; ++size_) {
+                new (data_ + size_) T(other.data_[size_]);
+            }
+        } catch (...) {  // no destructor runs for a constructor that throws
+            Clear();
+            Deallocate(data_, capacity_);
+            throw;
+        }
+    }
+
+    PtrVector(PtrVector&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)),
+          size_(std::exchange(other.size_, 0)),
+          capacity_(std::exchange(other.capacity_, 0)) {
+    }
+
+    PtrVector& operator=(PtrVector other) noexcept {
+        Swap(other);
+        return *this;
+    }
+
+    ~PtrVector() {
+        Clear();
+        Deallocate(data_, capacity_);
+    }
+
+    template <typename... Args>
+    T& EmplaceBack(Args&&... args) {
+        if (size_ < capacity_) {
+            new (data_ + size_) T(std::forward<Args>(args)...);
+        } else {
+            size_t capacity = std::max<size_t>(2 * capacity_, 1);
+            T* data = std::allocator<T>().allocate(capacity);
+            try {
+                new (data + size_) T(std::forward<Args>(args)...);  // `args` may be in the array
+            } catch (...) {
+                Deallocate(data, capacity);
+                throw;
+            }
+            try {
+                Relocate(data_, size_, data);
+            } catch (...) {
+                data[size_].~T();
+                Deallocate(data, capacity);
+                throw;
+            }
+            Deallocate(data_, capacity_);
+            data_ = data;
+            capacity_ = capacity;
+        }
+        return data_[size_++];
+    }
+
+    void PushBack(const T& value) {
+        EmplaceBack(value);
+    }
+    void PushBack(T&& value) {
+        EmplaceBack(std::move(value));
+    }
+
+    void PopBack() {
+        data_[--size_].~T();
+    }
+
+    void Reserve(size_t capacity) {
+        if (capacity <= capacity_) {
+            return;
+        }
+        T* data = std::allocator<T>().allocate(capacity);
+        try {
+            Relocate(data_, size_, data);
+        } catch (...) {
+            Deallocate(data, capacity);
+            throw;
+        }
+        Deallocate(data_, capacity_);
+        data_ = data;
+        capacity_ = capacity;
+    }
+
+    void Clear() {
+        std::destroy_n(data_, size_);
+        size_ = 0;
+    }
+
+    void Swap(PtrVector& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+    }
+
+    T& operator[](size_t i) {
+        return data_[i];
+    }
+    const T& operator[](size_t i) const {
+        return data_[i];
+    }
+
+    T* Data() {
+        return data_;
+    }
+    size_t Size() const {
+        return size_;
+    }
+    size_t Capacity() const {
+        return capacity_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    T* begin() {
+        return data_;
+    }
+    T* end() {
+        return data_ + size_;
+    }
+    const T* begin() const {
+        return data_;
+    }
+    const T* end() const {
+        return data_ + size_;
+    }
+
+private:
+    static void Deallocate(T* data, size_t capacity) {
+        if (data) {
+            std::allocator<T>().deallocate(data, capacity);
+        }
+    }
+
+    T* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
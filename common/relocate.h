@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Trivial relocation: moving an object to other memory and ending the life of the source has the
+// same effect as copying its bytes. True for the smart pointers of this library: they are a raw
+// pointer or two, the pointee does not know where its owners live, and a moved-from pointer has
+// nothing left to destroy. Specialize for a type to opt it in, `Relocate` and `PtrVector` then move
+// it with `memcpy` instead of a move constructor and a destructor per element.
+template <typename T>
+inline constexpr bool kTriviallyRelocatable = std::is_trivially_copyable_v<T>;
+
+// Moves `count` objects from `from` to the uninitialized memory at `to` and destroys the sources.
+// The ranges must not overlap.
+template <typename T>
+void Relocate(T* from, size_t count, T* to) noexcept(kTriviallyRelocatable<T> ||
+                                                      std::is_nothrow_move_constructible_v<T>) {
+    if constexpr (kTriviallyRelocatable<T>) {
+        if (count) {
+            std::memcpy(static_cast<void*>(to), static_cast<const void*>(from), count * sizeof(T));
+        }
+    } else if constexpr (std::is_nothrow_move_constructible_v<T>) {
+        for (size_t i = 0; i < count; ++i) {
+            new (to + i) T(std::move(from[i]));
+            from[i].~T();
+        }
+    } else {  // as `std::vector` does, copy if the move may throw, so that the sources survive
+        if constexpr (std::is_copy_constructible_v<T>) {
+            std::uninitialized_copy_n(from, count, to);
+        } else {
+            std::uninitialized_move_n(from, count, to);
+        }
+        std::destroy_n(from, count);
+    }
+}
@@ -0,0 +1,301 @@
+#pragma once
+
+// Per-type ownership counters of `SharedPtr` and `IntrusivePtr`, compiled in only when the library
+// is built with SMART_POINTERS_TELEMETRY. Otherwise this header is empty and the hooks in
+// `ControlBlockBase` and `RefCounted` are not there at all.
+//
+// Reference increments, the frequent events, go to counters of the calling thread. Creation and
+// destruction also update a live count and its peak shared by all threads, they come with an
+// allocation anyway. `Snapshot` adds everything up.
+#ifdef SMART_POINTERS_TELEMETRY
+
+#include <cxxabi.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+namespace telemetry {
+
+// Types past this share the counters of the last slot, `Snapshot` reports them as `kOtherTypes`
+inline constexpr size_t kMaxTypes = 256;
+inline constexpr const char* kOtherTypes = "(other types)";
+// Bucket i holds the lifetimes in [2^(i-1), 2^i) microseconds, the last one also everything longer
+inline constexpr size_t kLifetimeBuckets = 32;
+
+// One per type, constant-initialized so that it works during static initialization as well
+struct TypeRecord {
+    const std::type_info& (*type)();
+    std::atomic<uint32_t> slot = 0;  // in the thread counters, 0 until the first event
+    std::atomic<int64_t> created = 0;
+    std::atomic<int64_t> live = 0;
+    std::atomic<int64_t> peak = 0;
+};
+
+template <typename T>
+const std::type_info& TypeOf() {
+    return typeid(T);
+}
+
+template <typename T>
+inline TypeRecord kTypeRecord{&TypeOf<T>};
+
+struct TypeStats {
+    std::string name;
+    int64_t created = 0;
+    int64_t live = 0;
+    int64_t peak = 0;
+    uint64_t strong_increments = 0;
+    uint64_t weak_increments = 0;
+    std::array<uint64_t, kLifetimeBuckets> lifetimes = {};  // of the destroyed objects
+};
+
+inline uint64_t Now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+class Registry {
+public:
+    // Counters of one thread, written only by it. Shards are reused by later threads, never freed.
+    struct Shard {
+        std::atomic<uint64_t> strong[kMaxTypes] = {};
+        std::atomic<uint64_t> weak[kMaxTypes] = {};
+        std::atomic<uint64_t> lifetimes[kMaxTypes][kLifetimeBuckets] = {};
+        std::atomic<bool> in_use = false;
+        Shard* next = nullptr;
+    };
+
+    static Registry& Get() {
+        static Registry* registry = new Registry();  // outlives thread_local shard owners
+        return *registry;
+    }
+
+    uint32_t SlotOf(TypeRecord& record) {
+        uint32_t slot = record.slot.load(std::memory_order_acquire);
+        if (slot) {
+            return slot;
+        }
+        std::lock_guard lock(mutex_);
+        slot = record.slot.load(std::memory_order_relaxed);
+        if (!slot) {
+            types_.push_back(&record);
+            slot = static_cast<uint32_t>(std::min(types_.size(), kMaxTypes - 1));
+            record.slot.store(slot, std::memory_order_release);
+        }
+        return slot;
+    }
+
+    // Null once the thread has handed its shard back: the events of thread_local destructors that
+    // run after that are not counted
+    Shard* ThreadShard() {
+        ThreadState& state = State();
+        if (!state.shard && !state.exited) {
+            thread_local ShardOwner owner(*this);
+        }
+        return state.shard;
+    }
+
+    // The types that share the last slot are merged into one entry, its peak is the sum of theirs
+    std::vector<TypeStats> Snapshot() {
+        std::lock_guard lock(mutex_);
+        std::vector<TypeStats> result;
+        bool shared_slot = types_.size() >= kMaxTypes;
+        TypeStats other;
+        other.name = kOtherTypes;
+        for (TypeRecord* record : types_) {
+            uint32_t slot = record->slot.load(std::memory_order_relaxed);
+            if (shared_slot && slot == kMaxTypes - 1) {
+                AddRecord(other, *record);
+                continue;
+            }
+            TypeStats stats;
+            stats.name = Demangle(record->type().name());
+            AddRecord(stats, *record);
+            AddShards(stats, slot);
+            result.push_back(std::move(stats));
+        }
+        if (shared_slot) {
+            AddShards(other, kMaxTypes - 1);
+            result.push_back(std::move(other));
+        }
+        return result;
+    }
+
+private:
+    // Trivially destructible, so it stays readable during every thread_local destructor
+    struct ThreadState {
+        Shard* shard = nullptr;
+        bool exited = false;
+    };
+
+    struct ShardOwner {
+        explicit ShardOwner(Registry& registry) : shard(registry.AcquireShard()) {
+            State().shard = shard;
+        }
+        ~ShardOwner() {
+            State() = {nullptr, true};
+            shard->in_use.store(false, std::memory_order_release);
+        }
+        Shard* shard;
+    };
+
+    static ThreadState& State() {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    static void AddRecord(TypeStats& stats, const TypeRecord& record) {
+        stats.created += record.created.load(std::memory_order_relaxed);
+        stats.live += record.live.load(std::memory_order_relaxed);
+        stats.peak += record.peak.load(std::memory_order_relaxed);
+    }
+
+    void AddShards(TypeStats& stats, uint32_t slot) {
+        for (Shard* shard = shards_; shard; shard = shard->next) {
+            stats.strong_increments += shard->strong[slot].load(std::memory_order_relaxed);
+            stats.weak_increments += shard->weak[slot].load(std::memory_order_relaxed);
+            for (size_t i = 0; i < kLifetimeBuckets; ++i) {
+                stats.lifetimes[i] += shard->lifetimes[slot][i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    Registry() = default;
+
+    Shard* AcquireShard() {
+        std::lock_guard lock(mutex_);
+        for (Shard* shard = shards_; shard; shard = shard->next) {
+            if (!shard->in_use.load(std::memory_order_acquire)) {
+                shard->in_use.store(true, std::memory_order_relaxed);
+                return shard;
+            }
+        }
+        Shard* shard = new Shard();
+        shard->in_use.store(true, std::memory_order_relaxed);
+        shard->next = shards_;
+        shards_ = shard;
+        return shard;
+    }
+
+    static std::string Demangle(const char* name) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        if (status != 0) {
+            return name;
+        }
+        std::string result(demangled);
+        std::free(demangled);
+        return result;
+    }
+
+    std::mutex mutex_;
+    std::vector<TypeRecord*> types_;
+    Shard* shards_ = nullptr;
+};
+
+// Plain store, only the owner thread writes a shard
+inline void Bump(std::atomic<uint64_t>& counter, uint64_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+inline void OnCreate(TypeRecord& record) {
+    Registry::Get().SlotOf(record);
+    record.created.fetch_add(1, std::memory_order_relaxed);
+    int64_t live = record.live.fetch_add(1, std::memory_order_relaxed) + 1;
+    int64_t peak = record.peak.load(std::memory_order_relaxed);
+    while (live > peak &&
+           !record.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+// `born` is the `Now()` of the creation
+inline void OnDestroy(TypeRecord& record, uint64_t born) {
+    record.live.fetch_sub(1, std::memory_order_relaxed);
+    uint64_t lifetime = Now() - born;
+    size_t bucket = std::min<size_t>(std::bit_width(lifetime), kLifetimeBuckets - 1);
+    Registry& registry = Registry::Get();
+    if (Registry::Shard* shard = registry.ThreadShard()) {
+        Bump(shard->lifetimes[registry.SlotOf(record)][bucket], 1);
+    }
+}
+
+// The object was never constructed, its constructor threw
+inline void OnAbandon(TypeRecord& record) {
+    record.created.fetch_sub(1, std::memory_order_relaxed);
+    record.live.fetch_sub(1, std::memory_order_relaxed);
+}
+
+inline void OnStrongIncrement(TypeRecord& record, uint64_t count = 1) {
+    Registry& registry = Registry::Get();
+    if (Registry::Shard* shard = registry.ThreadShard()) {
+        Bump(shard->strong[registry.SlotOf(record)], count);
+    }
+}
+
+inline void OnWeakIncrement(TypeRecord& record) {
+    Registry& registry = Registry::Get();
+    if (Registry::Shard* shard = registry.ThreadShard()) {
+        Bump(shard->weak[registry.SlotOf(record)], 1);
+    }
+}
+
+inline std::vector<TypeStats> Snapshot() {
+    return Registry::Get().Snapshot();
+}
+
+// One object per type: {"type": ..., "created": ..., ..., "lifetime_us_log2": [...]}
+inline std::string ToJson(const std::vector<TypeStats>& snapshot) {
+    std::ostringstream out;
+    out << "[";
+    for (size_t i = 0; i < snapshot.size(); ++i) {
+        const TypeStats& stats = snapshot[i];
+        out << (i ? ",\n " : "") << "{\"type\": \"";
+        for (char c : stats.name) {
+            if (c == '"' || c == '\\') {
+                out << '\\';
+            }
+            out << c;
+        }
+        out << "\", \"created\": " << stats.created << ", \"live\": " << stats.live
+            << ", \"peak\": " << stats.peak
+            << ", \"strong_increments\": " << stats.strong_increments
+            << ", \"weak_increments\": " << stats.weak_increments << ", \"lifetime_us_log2\": [";
+        for (size_t bucket = 0; bucket < kLifetimeBuckets; ++bucket) {
+            out << (bucket ? ", " : "") << stats.lifetimes[bucket];
+        }
+        out << "]}";
+    }
+    out << "]\n";
+    return out.str();
+}
+
+inline std::string ToText(const std::vector<TypeStats>& snapshot) {
+    std::ostringstream out;
+    for (const TypeStats& stats : snapshot) {
+        out << stats.name << ": created " << stats.created << ", live " << stats.live << ", peak "
+            << stats.peak << ", strong increments " << stats.strong_increments
+            << ", weak increments " << stats.weak_increments << "\n  lifetimes:";
+        for (size_t bucket = 0; bucket < kLifetimeBuckets; ++bucket) {
+            if (stats.lifetimes[bucket]) {
+                out << " <" << (uint64_t(1) << bucket) << "us: " << stats.lifetimes[bucket];
+            }
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+}  // namespace telemetry
+
+#endif
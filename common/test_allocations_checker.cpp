@@ -0,0 +1,86 @@
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Counters") {
+    SECTION("Counts and bytes") {
+        alloc_checker::AllocationScope scope;
+        auto small = std::make_unique<int>(42);
+        auto large = std::make_unique<char[]>(1000);
+        small.reset();
+
+        alloc_checker::Stats delta = scope.Delta();
+        REQUIRE(delta.allocations == 2);
+        REQUIRE(delta.deallocations == 1);
+        REQUIRE(delta.allocated_bytes == sizeof(int) + 1000);
+        REQUIRE(delta.live_bytes >= 1000);
+    }
+
+    SECTION("Histogram") {
+        REQUIRE(alloc_checker::HistogramBucket(0) == 0);
+        REQUIRE(alloc_checker::HistogramBucket(1) == 0);
+        REQUIRE(alloc_checker::HistogramBucket(2) == 1);
+        REQUIRE(alloc_checker::HistogramBucket(3) == 2);
+        REQUIRE(alloc_checker::HistogramBucket(4) == 2);
+        REQUIRE(alloc_checker::HistogramBucket(1000) == 10);
+        REQUIRE(alloc_checker::HistogramBucket(size_t(1) << 40) ==
+                alloc_checker::kHistogramBuckets - 1);
+
+        alloc_checker::AllocationScope scope;
+        auto ptr = std::make_unique<char[]>(1000);
+        alloc_checker::Stats delta = scope.Delta();
+        REQUIRE(delta.histogram[10] == 1);
+        REQUIRE(delta.histogram[9] == 0);
+    }
+
+    SECTION("Over-aligned") {
+        struct alignas(64) Aligned {
+            char data[10];
+        };
+        EXPECT_ONE_ALLOCATION(auto ptr = std::make_unique<Aligned>());
+        EXPECT_NO_LEAKS(auto ptr = std::make_unique<Aligned>());
+    }
+
+    SECTION("Peak") {
+        alloc_checker::ResetThreadPeak();
+        int64_t start = alloc_checker::ThreadStats().live_bytes;
+        {
+            std::vector<char> buffer(1 << 20);
+        }
+        REQUIRE(alloc_checker::ThreadPeakLiveBytes() - start >= (1 << 20));
+        REQUIRE(alloc_checker::ThreadStats().live_bytes == start);
+    }
+}
+
+TEST_CASE("Scoped assertions") {
+    EXPECT_ZERO_ALLOCATIONS(int x = 42; (void)x);
+    EXPECT_ONE_ALLOCATION(auto ptr = std::make_unique<int>(42));
+    EXPECT_ALLOCATIONS(3, std::vector<std::unique_ptr<int>> v; v.reserve(2);
+                       v.push_back(std::make_unique<int>(1));
+                       v.push_back(std::make_unique<int>(2)));
+    EXPECT_ALLOCATED_BYTES(100, std::vector<char> v(100));
+    EXPECT_NO_LEAKS(std::vector<int> v(100); v.push_back(1));
+}
+
+TEST_CASE("Threads") {
+    alloc_checker::Stats global = alloc_checker::GlobalStats();
+    alloc_checker::AllocationScope scope;
+    size_t other = 0;
+    std::thread thread([&other] {
+        alloc_checker::AllocationScope own;
+        auto ptr = std::make_unique<int>(42);
+        other = own.Delta().allocations;
+    });
+    thread.join();
+    REQUIRE(other == 1);
+
+    // std::thread allocates its state here, the int belongs to the other thread
+    size_t own = scope.Delta().allocations;
+    REQUIRE((alloc_checker::GlobalStats() - global).allocations >= own + 1);
+}
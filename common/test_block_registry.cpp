@@ -0,0 +1,70 @@
+#define SMART_POINTERS_BLOCK_REGISTRY
+
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+
+#include <catch.hpp>
+
+#include <optional>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Leaked1 {
+    int data[10];
+};
+struct Leaked2 {};
+
+static std::optional<block_registry::LiveBlock> Find(const std::string& type) {
+    for (auto& live : block_registry::LiveBlocks()) {
+        if (live.type == type) {
+            return live;
+        }
+    }
+    return std::nullopt;
+}
+
+TEST_CASE("Live blocks") {
+    SECTION("MakeShared") {
+        {
+            auto sp = MakeShared<Leaked1>();
+            auto copy = sp;
+            auto live = Find("Leaked1");
+            REQUIRE(live);
+            REQUIRE(live->size == sizeof(Leaked1));
+            REQUIRE(live->strong == 2);
+            REQUIRE(live->weak == 0);
+            REQUIRE(!live->site.empty());
+        }
+        REQUIRE(!Find("Leaked1"));
+    }
+
+    SECTION("Pointer") {
+        WeakPtr<Leaked2> weak;
+        {
+            SharedPtr<Leaked2> sp(new Leaked2());
+            weak = sp;
+            auto live = Find("Leaked2");
+            REQUIRE(live);
+            REQUIRE(live->strong == 1);
+            REQUIRE(live->weak == 1);
+        }
+        auto live = Find("Leaked2");
+        REQUIRE(live);
+        REQUIRE(live->strong == 0);
+        REQUIRE(live->weak == 1);
+
+        weak.Reset();
+        REQUIRE(!Find("Leaked2"));
+    }
+
+    SECTION("Report") {
+        REQUIRE(block_registry::Report().empty());
+        auto sp = MakeShared<Leaked1>();
+        std::string report = block_registry::Report();
+        REQUIRE(report.find("1 live control block(s)") != std::string::npos);
+        std::string header = "Leaked1 (" + std::to_string(sizeof(Leaked1)) + " bytes)";
+        REQUIRE(report.find(header) != std::string::npos);
+        REQUIRE(report.find("strong 1, weak 0") != std::string::npos);
+    }
+}
@@ -0,0 +1,164 @@
+#define SMART_POINTERS_CYCLE_COLLECTOR
+
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::atomic<int> alive = 0;
+
+struct Node {
+    Node() {
+        ++alive;
+    }
+    ~Node() {
+        --alive;
+    }
+
+    void TraceRefs(CycleTracer& tracer) const {
+        tracer(next);
+        for (const auto& child : children) {
+            tracer(child);
+        }
+    }
+
+    SharedPtr<Node> next;
+    std::vector<SharedPtr<Node>> children;
+    WeakPtr<Node> parent;
+};
+
+struct Untraced {
+    SharedPtr<Untraced> next;
+};
+
+// Ring of `size` nodes, returns its first node
+static SharedPtr<Node> MakeRing(size_t size) {
+    auto first = MakeShared<Node>();
+    SharedPtr<Node> last = first;
+    for (size_t i = 1; i < size; ++i) {
+        last->next = MakeShared<Node>();
+        last = last->next;
+    }
+    last->next = first;
+    return first;
+}
+
+TEST_CASE("Cycle collection") {
+    CycleCollector::Get().SetCandidateLimit(0);
+
+    SECTION("Garbage cycles") {
+        auto make_garbage = [] {
+            auto pair = MakeRing(2);
+            SharedPtr<Node> self(new Node());
+            self->next = self;
+            pair.Reset();
+            self.Reset();
+            REQUIRE(alive == 3);
+
+            auto stats = CollectCycles();
+            REQUIRE(stats.collected == 3);
+            REQUIRE(alive == 0);
+        };
+        make_garbage();  // the collector keeps its buffers
+        EXPECT_NO_LEAKS(make_garbage());
+        REQUIRE(CycleCollector::Get().Candidates() == 0);
+    }
+
+    SECTION("Live cycles") {
+        auto ring = MakeRing(3);
+        auto copy = ring;
+        copy.Reset();
+        REQUIRE(CollectCycles().collected == 0);
+        REQUIRE(alive == 3);
+
+        // Garbage hanging off a live node goes, the node stays
+        auto garbage = MakeRing(2);
+        ring->children.push_back(garbage);
+        garbage->children.push_back(ring);
+        garbage.Reset();
+        REQUIRE(CollectCycles().collected == 0);
+        REQUIRE(alive == 5);
+
+        ring->children.clear();
+        REQUIRE(CollectCycles().collected == 2);
+        REQUIRE(alive == 3);
+
+        ring.Reset();
+        REQUIRE(CollectCycles().collected == 3);
+        REQUIRE(alive == 0);
+    }
+
+    SECTION("Weak references") {
+        auto parent = MakeShared<Node>();
+        auto child = MakeShared<Node>();
+        parent->children.push_back(child);
+        child->parent = parent;
+        child->next = parent;
+        WeakPtr<Node> weak = child;
+        parent.Reset();
+        child.Reset();
+
+        CollectCycles();
+        REQUIRE(alive == 0);
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Only traced types") {
+        auto untraced = MakeShared<Untraced>();
+        auto copy = untraced;
+        copy.Reset();
+        REQUIRE(CycleCollector::Get().Candidates() == 0);
+    }
+
+    SECTION("Long cycles") {
+        MakeRing(100000);
+        REQUIRE(alive == 100000);
+        REQUIRE(CollectCycles().collected == 100000);
+        REQUIRE(alive == 0);
+    }
+
+    SECTION("Full buffer") {
+        CycleCollector::Get().SetCandidateLimit(10);
+        for (int i = 0; i < 10; ++i) {
+            MakeRing(2);
+        }
+        REQUIRE(alive < 20);
+        REQUIRE(CycleCollector::Get().Candidates() < 10);
+        CollectCycles();
+        REQUIRE(alive == 0);
+        CycleCollector::Get().SetCandidateLimit(cycle_collector::kDefaultCandidateLimit);
+    }
+
+    SECTION("Manual by default") {
+        CycleCollector::Get().SetCandidateLimit(cycle_collector::kDefaultCandidateLimit);
+        for (int i = 0; i < 100; ++i) {
+            MakeRing(2);
+        }
+        REQUIRE(alive == 200);
+        REQUIRE(CollectCycles().collected == 200);
+    }
+
+    SECTION("Concurrent collections") {
+        for (int i = 0; i < 1000; ++i) {
+            MakeRing(3);
+        }
+        std::atomic<size_t> collected = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&collected] { collected += CollectCycles().collected; });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(collected == 3000);
+        REQUIRE(alive == 0);
+    }
+}
@@ -0,0 +1,132 @@
+#include <common/ptr_vector.h>
+#include <intrusive/intrusive.h>
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+#include <unique/unique.h>
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Counted : SimpleRefCounted<Counted> {};
+
+// The copy constructor throws once `copies_left` copies have been made
+struct ThrowingCopy {
+    explicit ThrowingCopy(int value) : value(MakeShared<int>(value)) {
+    }
+    ThrowingCopy(const ThrowingCopy& other) : value(other.value) {
+        if (copies_left-- == 0) {
+            throw std::runtime_error("copy");
+        }
+    }
+
+    SharedPtr<int> value;
+
+    static inline int copies_left = 0;
+};
+
+static_assert(std::is_nothrow_move_constructible_v<SharedPtr<int>>);
+static_assert(std::is_nothrow_move_assignable_v<SharedPtr<int>>);
+static_assert(std::is_nothrow_move_constructible_v<LocalSharedPtr<int>>);
+static_assert(std::is_nothrow_move_constructible_v<WeakPtr<int>>);
+static_assert(std::is_nothrow_move_assignable_v<WeakPtr<int>>);
+static_assert(std::is_nothrow_move_constructible_v<IntrusivePtr<Counted>>);
+static_assert(std::is_nothrow_move_assignable_v<IntrusivePtr<Counted>>);
+static_assert(std::is_nothrow_move_constructible_v<UniquePtr<int>>);
+static_assert(std::is_nothrow_move_assignable_v<UniquePtr<int>>);
+
+static_assert(kTriviallyRelocatable<SharedPtr<int>>);
+static_assert(kTriviallyRelocatable<LocalSharedPtr<int[]>>);
+static_assert(kTriviallyRelocatable<WeakPtr<int>>);
+static_assert(kTriviallyRelocatable<IntrusivePtr<Counted>>);
+static_assert(kTriviallyRelocatable<UniquePtr<int>>);
+static_assert(kTriviallyRelocatable<UniquePtr<int[]>>);
+static_assert(kTriviallyRelocatable<int*>);
+static_assert(!kTriviallyRelocatable<std::string>);
+
+TEST_CASE("Relocate") {
+    std::allocator<SharedPtr<int>> alloc;
+    SharedPtr<int>* from = alloc.allocate(3);
+    SharedPtr<int>* to = alloc.allocate(3);
+    auto ptr = MakeShared<int>(42);
+    for (int i = 0; i < 3; ++i) {
+        new (from + i) SharedPtr<int>(ptr);
+    }
+
+    Relocate(from, 3, to);
+    REQUIRE(ptr.UseCount() == 4);
+    REQUIRE(*to[2] == 42);
+
+    std::destroy_n(to, 3);
+    REQUIRE(ptr.UseCount() == 1);
+    alloc.deallocate(from, 3);
+    alloc.deallocate(to, 3);
+}
+
+TEST_CASE("PtrVector") {
+    SECTION("Growth") {
+        auto ptr = MakeShared<int>(42);
+        PtrVector<SharedPtr<int>> vector;
+        // One allocation per doubling, the pointers only copy their bytes
+        EXPECT_ALLOCATIONS(11, for (int i = 0; i < 1000; ++i) { vector.PushBack(ptr); });
+        REQUIRE(vector.Size() == 1000);
+        REQUIRE(vector.Capacity() == 1024);
+        REQUIRE(ptr.UseCount() == 1001);
+        for (const auto& copy : vector) {
+            REQUIRE(copy == ptr);
+        }
+
+        vector.PopBack();
+        REQUIRE(ptr.UseCount() == 1000);
+        auto moved = std::move(vector);
+        REQUIRE(vector.Empty());
+        moved.Clear();
+        REQUIRE(ptr.UseCount() == 1);
+    }
+
+    SECTION("Element of itself") {
+        PtrVector<IntrusivePtr<Counted>> vector;
+        vector.PushBack(MakeIntrusive<Counted>());
+        vector.PushBack(vector[0]);  // the growth must not free the argument first
+        REQUIRE(vector[0]->RefCount() == 2);
+    }
+
+    SECTION("Other types") {
+        PtrVector<std::string> strings;
+        for (int i = 0; i < 100; ++i) {
+            strings.EmplaceBack(50, 'a' + i % 26);
+        }
+        REQUIRE(strings[99] == std::string(50, 'a' + 99 % 26));
+
+        PtrVector<UniquePtr<int>> uniques;
+        uniques.Reserve(2);
+        uniques.EmplaceBack(new int(1));
+        uniques.EmplaceBack(new int(2));
+        uniques.EmplaceBack(new int(3));
+        REQUIRE(*uniques[0] + *uniques[1] + *uniques[2] == 6);
+
+        auto copy = strings;
+        REQUIRE(copy.Size() == 100);
+        REQUIRE(copy[0] == strings[0]);
+    }
+
+    SECTION("Throwing copy") {
+        EXPECT_NO_LEAKS({
+            PtrVector<ThrowingCopy> vector;
+            vector.Reserve(10);  // growth would copy the elements
+            for (int i = 0; i < 10; ++i) {
+                vector.EmplaceBack(i);
+            }
+            ThrowingCopy::copies_left = 5;
+            REQUIRE_THROWS_AS(PtrVector<ThrowingCopy>(vector), std::runtime_error);
+            REQUIRE(vector[0].value.UseCount() == 1);  // the copies made are gone
+        });
+    }
+}
@@ -0,0 +1,152 @@
+#define SMART_POINTERS_TELEMETRY
+
+#include <intrusive/intrusive.h>
+#include <shared-from-this/shared.h>
+#include <shared-from-this/weak.h>
+
+#include <catch.hpp>
+
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static telemetry::TypeStats StatsOf(const std::string& name) {
+    for (const auto& stats : telemetry::Snapshot()) {
+        if (stats.name == name) {
+            return stats;
+        }
+    }
+    return {};
+}
+
+static uint64_t Destroyed(const telemetry::TypeStats& stats) {
+    uint64_t total = 0;
+    for (uint64_t count : stats.lifetimes) {
+        total += count;
+    }
+    return total;
+}
+
+struct Tracked1 {};
+struct Tracked2 {};
+struct Tracked3 : SimpleRefCounted<Tracked3> {};
+
+struct Tracked4 {
+    Tracked4() {
+        throw 42;
+    }
+};
+
+struct Tracked5 {};
+
+template <size_t N>
+struct Numbered {};
+
+TEST_CASE("SharedPtr telemetry") {
+    SECTION("References") {
+        {
+            auto sp = MakeShared<Tracked1>();
+            auto copy = sp;
+            WeakPtr<Tracked1> weak = sp;
+            auto locked = weak.Lock();
+
+            auto stats = StatsOf("Tracked1");
+            REQUIRE(stats.created == 1);
+            REQUIRE(stats.live == 1);
+            REQUIRE(stats.strong_increments == 3);
+            REQUIRE(stats.weak_increments == 1);
+            REQUIRE(Destroyed(stats) == 0);
+        }
+        auto stats = StatsOf("Tracked1");
+        REQUIRE(stats.live == 0);
+        REQUIRE(stats.peak == 1);
+        REQUIRE(Destroyed(stats) == 1);
+    }
+
+    SECTION("Peak over threads") {
+        std::vector<SharedPtr<Tracked2>> objects(8);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&objects, i] {
+                objects[2 * i] = MakeShared<Tracked2>();
+                objects[2 * i + 1] = objects[2 * i];
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        objects.clear();
+
+        auto stats = StatsOf("Tracked2");
+        REQUIRE(stats.created == 4);
+        REQUIRE(stats.live == 0);
+        REQUIRE(stats.peak == 4);
+        REQUIRE(stats.strong_increments == 8);
+        REQUIRE(Destroyed(stats) == 4);
+    }
+
+    SECTION("Release after the thread shard is gone") {
+        std::thread([] {
+            // Constructed before the shard owner, so destroyed after it
+            thread_local SharedPtr<Tracked5> late;
+            late = MakeShared<Tracked5>();
+        }).join();
+        auto stats = StatsOf("Tracked5");
+        REQUIRE(stats.created == 1);
+        REQUIRE(stats.live == 0);
+        REQUIRE(Destroyed(stats) == 0);  // no shard to count it in
+    }
+
+    SECTION("Faulty constructor") {
+        REQUIRE_THROWS(MakeShared<Tracked4>());
+        auto stats = StatsOf("Tracked4");
+        REQUIRE(stats.created == 0);
+        REQUIRE(stats.live == 0);
+    }
+}
+
+TEST_CASE("IntrusivePtr telemetry") {
+    {
+        auto ptr = MakeIntrusive<Tracked3>();
+        auto copy = ptr;
+        REQUIRE(StatsOf("Tracked3").live == 1);
+    }
+    auto stats = StatsOf("Tracked3");
+    REQUIRE(stats.created == 1);
+    REQUIRE(stats.live == 0);
+    REQUIRE(stats.strong_increments == 2);
+    REQUIRE(Destroyed(stats) == 1);
+}
+
+TEST_CASE("Telemetry reports") {
+    auto sp = MakeShared<Tracked1>();
+    auto snapshot = telemetry::Snapshot();
+    std::string json = telemetry::ToJson(snapshot);
+    REQUIRE(json.front() == '[');
+    REQUIRE(json.find("\"type\": \"Tracked1\"") != std::string::npos);
+    REQUIRE(json.find("\"lifetime_us_log2\": [") != std::string::npos);
+    REQUIRE(telemetry::ToText(snapshot).find("Tracked1: created") != std::string::npos);
+}
+
+// Last, so that the types of the other tests have slots of their own
+TEST_CASE("Telemetry past kMaxTypes") {
+    [&]<size_t... I>(std::index_sequence<I...>) {
+        (MakeShared<Numbered<I>>(), ...);
+    }(std::make_index_sequence<telemetry::kMaxTypes>());
+
+    auto snapshot = telemetry::Snapshot();
+    REQUIRE(snapshot.size() == telemetry::kMaxTypes - 1);
+    REQUIRE(snapshot.back().name == telemetry::kOtherTypes);
+
+    // Every type is counted once
+    int64_t created = 0;
+    for (const auto& stats : snapshot) {
+        if (stats.name.starts_with("Numbered") || stats.name == telemetry::kOtherTypes) {
+            created += stats.created;
+        }
+    }
+    REQUIRE(created == static_cast<int64_t>(telemetry::kMaxTypes));
+}
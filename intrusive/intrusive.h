@@ -1,5 +1,8 @@
 #pragma once
 
+#include <common/relocate.h>
+#include <common/telemetry.h>
+
 #include <cstddef>  // for std::nullptr_t
 #include <utility>  // for std::exchange / std::swap
 
@@ -21,6 +24,12 @@ public:
     size_t DecRef() {
         return --count_;
     }
+    size_t IncRef(size_t count) {
+        return count_ += count;
+    }
+    size_t DecRef(size_t count) {
+        return count_ -= count;
+    }
     size_t RefCount() const {
         return count_;
     }
@@ -39,8 +48,29 @@ struct DefaultDelete {
 template <typename Derived, typename Counter, typename Deleter>
 class RefCounted {
 public:
+#ifdef SMART_POINTERS_TELEMETRY
+    RefCounted() : born_(telemetry::Now()) {
+        telemetry::OnCreate(telemetry::kTypeRecord<Derived>);
+    }
+
+    RefCounted(const RefCounted& other) : RefCounted() {
+    }
+
+    RefCounted& operator=(const RefCounted& other) {  // keeps the birth time
+        counter_ = other.counter_;
+        return *this;
+    }
+
+    ~RefCounted() {
+        telemetry::OnDestroy(telemetry::kTypeRecord<Derived>, born_);
+    }
+#endif
+
     // Increase reference counter.
     void IncRef() {
+#ifdef SMART_POINTERS_TELEMETRY
+        telemetry::OnStrongIncrement(telemetry::kTypeRecord<Derived>);
+#endif
         counter_.IncRef();
     }
     // Decrease reference counter.
@@ -51,6 +81,33 @@ public:
         }
     }
 
+    // Batch versions, one counter update for `count` references if `Counter` has them
+    void IncRef(size_t count) {
+#ifdef SMART_POINTERS_TELEMETRY
+        telemetry::OnStrongIncrement(telemetry::kTypeRecord<Derived>, count);
+#endif
+        if constexpr (requires(Counter& counter) { counter.IncRef(count); }) {
+            counter_.IncRef(count);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                counter_.IncRef();
+            }
+        }
+    }
+    void DecRef(size_t count) {
+        size_t left = 0;
+        if constexpr (requires(Counter& counter) { counter.DecRef(count); }) {
+            left = counter_.DecRef(count);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                left = counter_.DecRef();
+            }
+        }
+        if (!left) {
+            Deleter().Destroy(static_cast<Derived*>(this));
+        }
+    }
+
     // Get current counter value (the number of strong references).
     size_t RefCount() const {
         return counter_.RefCount();
@@ -58,6 +115,9 @@ public:
 
 private:
     Counter counter_;
+#ifdef SMART_POINTERS_TELEMETRY
+    uint64_t born_;
+#endif
 };
 
 template <typename Derived, typename D = DefaultDelete>
@@ -84,14 +144,14 @@ public:
     }
 
     template <typename Y>
-    IntrusivePtr(IntrusivePtr<Y>&& other) : ptr_(other.ptr_) {
+    IntrusivePtr(IntrusivePtr<Y>&& other) noexcept : ptr_(other.ptr_) {
         other.ptr_ = nullptr;  // if other == nullptr, then no Inc and Dec, if not that Inc+Dec=0
     }
 
     IntrusivePtr(const IntrusivePtr& other) : ptr_(other.ptr_) {
         Inc();
     }
-    IntrusivePtr(IntrusivePtr&& other) : ptr_(other.ptr_) {
+    IntrusivePtr(IntrusivePtr&& other) noexcept : ptr_(other.ptr_) {
         other.ptr_ = nullptr;
     }
 
@@ -102,7 +162,7 @@ public:
         ptr_ = other.ptr_;
         return *this;
     }
-    IntrusivePtr& operator=(IntrusivePtr&& other) {
+    IntrusivePtr& operator=(IntrusivePtr&& other) noexcept {
         if (ptr_ != other.ptr_) {
             Dec();
             ptr_ = other.ptr_;
@@ -128,10 +188,49 @@ public:
             Inc();
         }
     }
-    void Swap(IntrusivePtr& other) {
+    void Swap(IntrusivePtr& other) noexcept {
         std::swap(ptr_, other.ptr_);
     }
 
+    // Same as `SharedPtr::CloneN`, one counter update if `T` has `IncRef(count)` as `RefCounted`
+    template <typename OutputIt>
+    OutputIt CloneN(size_t count, OutputIt out) const {
+        if (ptr_ && count) {
+            IncRefs(ptr_, count);
+        }
+        size_t written = 0;
+        try {
+            for (; written < count; ++written) {
+                IntrusivePtr copy;  // adopts one of the references
+                copy.ptr_ = ptr_;
+                *out = std::move(copy);
+                ++out;
+            }
+        } catch (...) {  // the copy that failed has released its reference
+            if (ptr_ && count - written > 1) {
+                DecRefs(ptr_, count - written - 1);
+            }
+            throw;
+        }
+        return out;
+    }
+
+    // Same as `SharedPtr::ReleaseAll`
+    template <typename ForwardIt>
+    static void ReleaseAll(ForwardIt first, ForwardIt last) {
+        while (first != last) {
+            T* ptr = first->ptr_;
+            size_t count = 0;
+            for (; first != last && first->ptr_ == ptr; ++first) {
+                first->ptr_ = nullptr;
+                ++count;
+            }
+            if (ptr) {
+                DecRefs(ptr, count);
+            }
+        }
+    }
+
     // Observers
     T* Get() const {
         return ptr_;
@@ -169,8 +268,32 @@ private:
             ptr_->DecRef();
         }
     }
+
+    static void IncRefs(T* ptr, size_t count) {
+        if constexpr (requires { ptr->IncRef(count); }) {
+            ptr->IncRef(count);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                ptr->IncRef();
+            }
+        }
+    }
+
+    static void DecRefs(T* ptr, size_t count) {
+        if constexpr (requires { ptr->DecRef(count); }) {
+            ptr->DecRef(count);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                ptr->DecRef();
+            }
+        }
+    }
 };
 
+// The count is in the object, see common/relocate.h
+template <typename T>
+inline constexpr bool kTriviallyRelocatable<IntrusivePtr<T>> = true;
+
 template <typename T, typename... Args>
 IntrusivePtr<T> MakeIntrusive(Args&&... args) {
     return IntrusivePtr<T>(new T(std::forward<Args>(args)...));  // first create then pass
@@ -4,7 +4,9 @@
 
 #include "allocations_checker.h"
 
+#include <iterator>
 #include <string>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -386,3 +388,52 @@ TEST_CASE("Object pool") {
         REQUIRE(strs.NumInUse() == 1);
     }
 }
+
+// Counts the calls, only has the single-step interface
+struct Plain {
+    void IncRef() {
+        ++count;
+        ++increments;
+    }
+    void DecRef() {
+        if (--count == 0) {
+            delete this;
+        }
+    }
+    size_t RefCount() const {
+        return count;
+    }
+
+    size_t count = 0;
+    size_t increments = 0;
+};
+
+TEST_CASE("Batch references") {
+    SECTION("RefCounted") {
+        CountedString::ResetCounters();
+        auto ptr = MakeIntrusive<CountedString>("fan-out");
+        std::vector<IntrusivePtr<CountedString>> copies(4);
+        REQUIRE(ptr.CloneN(4, copies.begin()) == copies.end());
+        REQUIRE(ptr.UseCount() == 5);
+        REQUIRE(*copies[3] == "fan-out");
+
+        copies.insert(copies.begin() + 2, IntrusivePtr<CountedString>());
+        IntrusivePtr<CountedString>::ReleaseAll(copies.begin(), copies.end());
+        REQUIRE(ptr.UseCount() == 1);
+        REQUIRE(!copies[0]);
+
+        ptr.CloneN(2, copies.begin());
+        ptr.Reset();
+        IntrusivePtr<CountedString>::ReleaseAll(copies.begin(), copies.end());
+        REQUIRE(CountedString::NumAlive() == 0);
+    }
+
+    SECTION("Single-step counters") {
+        IntrusivePtr<Plain> ptr(new Plain());
+        std::vector<IntrusivePtr<Plain>> copies;
+        ptr.CloneN(3, std::back_inserter(copies));
+        REQUIRE(ptr->increments == 4);
+        IntrusivePtr<Plain>::ReleaseAll(copies.begin(), copies.end());
+        REQUIRE(ptr.UseCount() == 1);
+    }
+}
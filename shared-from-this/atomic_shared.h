@@ -0,0 +1,375 @@
+#pragma once
+
+#include "hazard_pointer.h"
+#include "shared.h"
+#include "weak.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
+// Lock-free atomic `SharedPtr` and `WeakPtr`, like std::atomic<std::shared_ptr<T>>
+
+// The blocks `SplitRefCount` publishes, they carry their own node for `HazardDomain::Retire`
+class ControlBlockSnapshotBase : public ControlBlockBase {
+public:
+    HazardDomain::Retired& RetiredNode() {
+        return retired_;
+    }
+
+protected:
+    using ControlBlockBase::ControlBlockBase;
+
+private:
+    HazardDomain::Retired retired_;
+};
+
+// Control block whose "object" is a `SharedPtr` or a `WeakPtr`. Every store into an atomic pointer
+// wraps the value into a fresh snapshot, readers reach it with one `fetch_add` on the split count.
+template <typename Ptr>
+class ControlBlockSnapshot : public ControlBlockSnapshotBase {
+public:
+    explicit ControlBlockSnapshot(Ptr&& value)
+        : ControlBlockSnapshotBase(&kVTable), value_(std::move(value)) {
+    }
+
+    const Ptr& GetValue() const {
+        return value_;
+    }
+
+private:
+    static void DestroyObject(ControlBlockBase* base) {
+        static_cast<ControlBlockSnapshot*>(base)->value_.Reset();
+    }
+
+    static void DeallocateBlock(ControlBlockBase* base) {
+        delete static_cast<ControlBlockSnapshot*>(base);
+    }
+
+    static constexpr VTable kVTable = MakeVTable<Ptr>(&DestroyObject, &DeallocateBlock);
+
+    Ptr value_;
+};
+
+// Split reference count, the scheme of folly::atomic_shared_ptr. One atomic word keeps the block
+// pointer in the low 48 bits and a local count in the high 16 bits. Publishing a block reserves
+// `kReserve` strong references on it, a reader takes one of them with a single `fetch_add` on the
+// word. Whoever sees the local count past `kRefillAt` moves it into the block, and whoever replaces
+// the block gives back the references nobody took, through the hazard domain so that readers in
+// `Protect` keep using it. The blocks are `ControlBlockSnapshotBase`s.
+class SplitRefCount {
+public:
+    SplitRefCount() = default;
+
+    // Takes over `block`, which already holds the reserved references, see `Reserve`
+    explicit SplitRefCount(ControlBlockBase* block) : word_(Pack(block, 0)) {
+    }
+
+    SplitRefCount(const SplitRefCount&) = delete;
+    SplitRefCount& operator=(const SplitRefCount&) = delete;
+
+    ~SplitRefCount() {
+        Retire(word_.load(std::memory_order_acquire), 0);
+    }
+
+    static ControlBlockBase* Reserve(ControlBlockBase* block) {
+        if (block) {
+            block->IncStrongRefs(kReserve);
+        }
+        return block;
+    }
+
+    // Drops a reserved block that was never stored
+    static void Unreserve(ControlBlockBase* block) {
+        if (block && block->DecStrongRefs(kReserve)) {
+            block->DeallocateBlock();
+        }
+    }
+
+    // Drops a reference returned by `Acquire` or `Exchange`
+    static void Release(ControlBlockBase* block) {
+        if (block && block->DecStrongRefs(1)) {
+            block->DeallocateBlock();
+        }
+    }
+
+    static ControlBlockBase* BlockOf(uintptr_t word) {
+        return reinterpret_cast<ControlBlockBase*>(word & kPointerMask);
+    }
+
+    // The current block without taking a reference, only for `HazardPointer::Protect`
+    ControlBlockBase* Peek() const {
+        return BlockOf(word_.load(std::memory_order_acquire));
+    }
+
+    // Returns the current word, the caller owns one strong reference to its block
+    uintptr_t Acquire() {
+        uintptr_t word = word_.fetch_add(kOne, std::memory_order_acq_rel) + kOne;
+        if (BlockOf(word) && CountOf(word) >= kRefillAt) {
+            Refill(word);
+        }
+        return word;
+    }
+
+    // `block` has to be reserved. Returns the old block with one strong reference for the caller.
+    ControlBlockBase* Exchange(ControlBlockBase* block) {
+        uintptr_t old = word_.exchange(Pack(block, 0), std::memory_order_acq_rel);
+        Retire(old, 1);
+        return BlockOf(old);
+    }
+
+    // `word` comes from `Acquire`. Replaces its block with `block` unless some other block was
+    // stored meanwhile, a changed local count alone does not fail it. The reference taken by
+    // `Acquire` stays with the caller either way.
+    bool Replace(uintptr_t word, ControlBlockBase* block) {
+        ControlBlockBase* expected = BlockOf(word);
+        while (BlockOf(word) == expected) {
+            if (word_.compare_exchange_weak(word, Pack(block, 0), std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+                Retire(word, 0);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static constexpr bool kIsAlwaysLockFree = std::atomic<uintptr_t>::is_always_lock_free;
+
+private:
+    static_assert(sizeof(uintptr_t) == 8, "the pointer and the count share a 64-bit word");
+
+    static constexpr int kCountShift = 48;  // user-space addresses on x86-64 and AArch64
+    static constexpr uintptr_t kOne = uintptr_t(1) << kCountShift;
+    static constexpr uintptr_t kPointerMask = kOne - 1;
+
+    // The count may run past `kRefillAt` until the refill goes through, never up to 0xFFFF
+    static constexpr size_t kReserve = 0xFFFF;
+    static constexpr size_t kRefillAt = 0x8000;
+
+    static uintptr_t Pack(ControlBlockBase* block, size_t count) {
+        auto address = reinterpret_cast<uintptr_t>(block);
+        assert((address & ~kPointerMask) == 0);
+        return address | (uintptr_t(count) << kCountShift);
+    }
+
+    static size_t CountOf(uintptr_t word) {
+        return word >> kCountShift;
+    }
+
+    // Moves the taken references from the word to the block. The caller holds one of them, so
+    // undoing a failed attempt never drops the block.
+    void Refill(uintptr_t word) {
+        ControlBlockBase* block = BlockOf(word);
+        size_t count = CountOf(word);
+        block->IncStrongRefs(count);
+        if (!word_.compare_exchange_strong(word, Pack(block, 0), std::memory_order_acq_rel,
+                                           std::memory_order_relaxed)) {
+            block->DecStrongRefs(count);
+        }
+    }
+
+    // The word was just taken out, release the references no reader took except for `keep`
+    static void Retire(uintptr_t word, size_t keep) {
+        if (ControlBlockBase* block = BlockOf(word)) {
+            auto& node = static_cast<ControlBlockSnapshotBase*>(block)->RetiredNode();
+            HazardDomain::Default().Retire(block, kReserve - CountOf(word) - keep, node);
+        }
+    }
+
+    std::atomic<uintptr_t> word_ = 0;
+};
+
+// `Store` allocates a snapshot block. `Load` takes a reference on the snapshot with a `fetch_add`,
+// copies the stored value out and drops that reference again, so a loaded pointer owns the object
+// through its own block like any other copy. `CompareExchange*` match `expected` by pointer and
+// block.
+template <typename T>
+class AtomicSharedPtr {
+public:
+    AtomicSharedPtr() = default;
+
+    AtomicSharedPtr(SharedPtr<T> desired) : count_(Wrap(std::move(desired))) {
+    }
+
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    SharedPtr<T> Load() const {
+        return CopyOut(SplitRefCount::BlockOf(count_.Acquire()));
+    }
+
+    // Reads without touching any counter. The pointer stays valid until `hazard` is reset or
+    // destroyed, even if the value is replaced meanwhile.
+    typename SharedPtr<T>::element_type* Protect(HazardPointer& hazard) const {
+        ControlBlockBase* snapshot = hazard.Protect([this] { return count_.Peek(); });
+        if (!snapshot) {
+            return nullptr;
+        }
+        return static_cast<Snapshot*>(snapshot)->GetValue().ptr_;
+    }
+
+    void Store(SharedPtr<T> desired) {
+        SplitRefCount::Release(count_.Exchange(Wrap(std::move(desired))));
+    }
+
+    SharedPtr<T> Exchange(SharedPtr<T> desired) {
+        return CopyOut(count_.Exchange(Wrap(std::move(desired))));
+    }
+
+    // Never fails spuriously, same as `CompareExchangeStrong`
+    bool CompareExchangeWeak(SharedPtr<T>& expected, SharedPtr<T> desired) {
+        return CompareExchangeStrong(expected, std::move(desired));
+    }
+
+    bool CompareExchangeStrong(SharedPtr<T>& expected, SharedPtr<T> desired) {
+        ControlBlockBase* snapshot = Wrap(std::move(desired));
+        while (true) {
+            uintptr_t word = count_.Acquire();
+            ControlBlockBase* current = SplitRefCount::BlockOf(word);
+            if (!Matches(current, expected)) {
+                SplitRefCount::Unreserve(snapshot);
+                expected = CopyOut(current);
+                return false;
+            }
+            bool replaced = count_.Replace(word, snapshot);
+            SplitRefCount::Release(current);
+            if (replaced) {
+                return true;
+            }
+        }
+    }
+
+    static constexpr bool kIsAlwaysLockFree = SplitRefCount::kIsAlwaysLockFree;
+
+private:
+    using Snapshot = ControlBlockSnapshot<SharedPtr<T>>;
+
+    static ControlBlockBase* Wrap(SharedPtr<T>&& value) {
+        if (!value.block_) {
+            return nullptr;
+        }
+        return SplitRefCount::Reserve(new Snapshot(std::move(value)));
+    }
+
+    static const SharedPtr<T>& Value(ControlBlockBase* snapshot) {
+        return static_cast<Snapshot*>(snapshot)->GetValue();
+    }
+
+    static bool Matches(ControlBlockBase* snapshot, const SharedPtr<T>& expected) {
+        if (!snapshot) {
+            return !expected.block_;
+        }
+        const SharedPtr<T>& value = Value(snapshot);
+        return expected.ptr_ == value.ptr_ && expected.block_ == value.block_;
+    }
+
+    // Copies the value and drops the reference taken from the split count, also if the copy throws
+    // `RefCountOverflow`
+    static SharedPtr<T> CopyOut(ControlBlockBase* snapshot) {
+        if (!snapshot) {
+            return SharedPtr<T>();
+        }
+        SharedPtr<T> value;
+        try {
+            value = Value(snapshot);
+        } catch (...) {
+            SplitRefCount::Release(snapshot);
+            throw;
+        }
+        SplitRefCount::Release(snapshot);
+        return value;
+    }
+
+    mutable SplitRefCount count_;
+};
+
+// Same scheme for `WeakPtr`: the snapshot holds a weak reference, which `Load` copies out
+template <typename T>
+class AtomicWeakPtr {
+public:
+    AtomicWeakPtr() = default;
+
+    AtomicWeakPtr(WeakPtr<T> desired) : count_(Wrap(std::move(desired))) {
+    }
+
+    AtomicWeakPtr(const AtomicWeakPtr&) = delete;
+    AtomicWeakPtr& operator=(const AtomicWeakPtr&) = delete;
+
+    WeakPtr<T> Load() const {
+        return CopyOut(SplitRefCount::BlockOf(count_.Acquire()));
+    }
+
+    void Store(WeakPtr<T> desired) {
+        SplitRefCount::Release(count_.Exchange(Wrap(std::move(desired))));
+    }
+
+    WeakPtr<T> Exchange(WeakPtr<T> desired) {
+        return CopyOut(count_.Exchange(Wrap(std::move(desired))));
+    }
+
+    bool CompareExchangeWeak(WeakPtr<T>& expected, WeakPtr<T> desired) {
+        return CompareExchangeStrong(expected, std::move(desired));
+    }
+
+    // `expected` matches if it points to the same object through the same block
+    bool CompareExchangeStrong(WeakPtr<T>& expected, WeakPtr<T> desired) {
+        ControlBlockBase* snapshot = Wrap(std::move(desired));
+        while (true) {
+            uintptr_t word = count_.Acquire();
+            ControlBlockBase* current = SplitRefCount::BlockOf(word);
+            if (!Matches(current, expected)) {
+                SplitRefCount::Unreserve(snapshot);
+                expected = CopyOut(current);
+                return false;
+            }
+            bool replaced = count_.Replace(word, snapshot);
+            SplitRefCount::Release(current);
+            if (replaced) {
+                return true;
+            }
+        }
+    }
+
+    static constexpr bool kIsAlwaysLockFree = SplitRefCount::kIsAlwaysLockFree;
+
+private:
+    using Snapshot = ControlBlockSnapshot<WeakPtr<T>>;
+
+    static ControlBlockBase* Wrap(WeakPtr<T>&& value) {
+        if (!value.block_) {
+            return nullptr;
+        }
+        return SplitRefCount::Reserve(new Snapshot(std::move(value)));
+    }
+
+    static const WeakPtr<T>& Value(ControlBlockBase* snapshot) {
+        return static_cast<Snapshot*>(snapshot)->GetValue();
+    }
+
+    static bool Matches(ControlBlockBase* snapshot, const WeakPtr<T>& expected) {
+        if (!snapshot) {
+            return !expected.block_;
+        }
+        const WeakPtr<T>& value = Value(snapshot);
+        return expected.ptr_ == value.ptr_ && expected.block_ == value.block_;
+    }
+
+    // Copies the value and drops the reference taken from the split count, also if the copy throws
+    // `RefCountOverflow`
+    static WeakPtr<T> CopyOut(ControlBlockBase* snapshot) {
+        if (!snapshot) {
+            return WeakPtr<T>();
+        }
+        WeakPtr<T> value;
+        try {
+            value = Value(snapshot);
+        } catch (...) {
+            SplitRefCount::Release(snapshot);
+            throw;
+        }
+        SplitRefCount::Release(snapshot);
+        return value;
+    }
+
+    mutable SplitRefCount count_;
+};
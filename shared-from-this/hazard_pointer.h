@@ -0,0 +1,196 @@
+#pragma once
+
+#include "sw_fwd.h"
+
+#include <atomic>
+#include <exception>
+
+// Hazard pointers for control blocks: a reader publishes the block it is about to use in a slot of
+// its thread, and the references that keep the block alive are not dropped while any slot holds
+// it. Reading under a hazard is a plain store and a fence, no RMW on the line of the block.
+// `AtomicSharedPtr::Protect` is the reader side, `SplitRefCount` retires blocks through it.
+// Thrown when a thread already holds `HazardDomain::kSlotsPerThread` live `HazardPointer`s
+class HazardSlotsExhausted : public std::exception {};
+
+class HazardDomain {
+public:
+    static constexpr int kSlotsPerThread = 8;
+
+    // Hazard slots of one thread. Records are reused by later threads and never freed.
+    struct Record {
+        std::atomic<ControlBlockBase*> slots[kSlotsPerThread] = {};
+        std::atomic<bool> in_use = false;
+        unsigned used_mask = 0;  // touched only by the owner thread
+        Record* next = nullptr;
+    };
+
+    // Link of a retired block that a reader still protects. The owner of the block provides it,
+    // e.g. inside the block, so retiring never allocates.
+    struct Retired {
+        ControlBlockBase* block = nullptr;
+        size_t count = 0;
+        Retired* next = nullptr;
+    };
+
+    static HazardDomain& Default() {
+        static HazardDomain* domain = new HazardDomain();  // outlives thread_local records
+        return *domain;
+    }
+
+    // Drops `count` strong references to `block` now or, if a reader holds a hazard on it, once
+    // the last such hazard is reset. `node` stays untouched until then, each block is retired once.
+    void Retire(ControlBlockBase* block, size_t count, Retired& node) {
+        if (count == 0) {
+            return;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);  // pairs with the one in `Protect`
+        if (IsProtected(block)) {
+            node = {block, count, nullptr};
+            Push(&node);
+        } else {
+            Release(block, count);
+        }
+        if (retired_.load(std::memory_order_relaxed)) {
+            Reclaim();
+        }
+    }
+
+    // Releases every retired block nobody protects anymore
+    void Reclaim() {
+        Retired* list = retired_.exchange(nullptr, std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (list) {
+            Retired* next = list->next;
+            if (IsProtected(list->block)) {
+                Push(list);
+            } else {
+                Release(list->block, list->count);  // may free the node
+            }
+            list = next;
+        }
+    }
+
+    // Called after a hazard is reset, releases what it held back
+    void ReclaimIfRetired() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);  // pairs with the one in `Reclaim`
+        if (retired_.load(std::memory_order_relaxed)) {
+            Reclaim();
+        }
+    }
+
+    // The record of the calling thread, taken on first use and handed back when the thread exits
+    Record& ThreadRecord() {
+        thread_local RecordOwner owner(*this);
+        return *owner.record;
+    }
+
+private:
+    struct RecordOwner {
+        explicit RecordOwner(HazardDomain& domain) : record(domain.AcquireRecord()) {
+        }
+        ~RecordOwner() {
+            record->in_use.store(false, std::memory_order_release);
+        }
+        Record* record;
+    };
+
+    HazardDomain() = default;
+
+    Record* AcquireRecord() {
+        for (Record* record = records_.load(std::memory_order_acquire); record;
+             record = record->next) {
+            bool expected = false;
+            if (record->in_use.compare_exchange_strong(expected, true)) {
+                return record;
+            }
+        }
+        Record* record = new Record();
+        record->in_use.store(true, std::memory_order_relaxed);
+        record->next = records_.load(std::memory_order_relaxed);
+        while (!records_.compare_exchange_weak(record->next, record, std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+        }
+        return record;
+    }
+
+    bool IsProtected(ControlBlockBase* block) const {
+        for (Record* record = records_.load(std::memory_order_acquire); record;
+             record = record->next) {
+            for (const auto& slot : record->slots) {
+                if (slot.load(std::memory_order_acquire) == block) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void Push(Retired* retired) {
+        retired->next = retired_.load(std::memory_order_relaxed);
+        while (!retired_.compare_exchange_weak(retired->next, retired, std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+        }
+    }
+
+    static void Release(ControlBlockBase* block, size_t count) {
+        if (block->DecStrongRefs(count)) {
+            block->DeallocateBlock();
+        }
+    }
+
+    std::atomic<Record*> records_ = nullptr;
+    std::atomic<Retired*> retired_ = nullptr;
+};
+
+// One hazard slot of the calling thread, held for the lifetime of the object. Not movable, create
+// it on the stack of the reading thread. Throws `HazardSlotsExhausted` if no slot is free.
+class HazardPointer {
+public:
+    HazardPointer() : record_(HazardDomain::Default().ThreadRecord()) {
+        if (record_.used_mask == (1u << HazardDomain::kSlotsPerThread) - 1) {
+            throw HazardSlotsExhausted();
+        }
+        while (record_.used_mask & (1u << index_)) {
+            ++index_;
+        }
+        record_.used_mask |= 1u << index_;
+    }
+
+    HazardPointer(const HazardPointer&) = delete;
+    HazardPointer& operator=(const HazardPointer&) = delete;
+
+    ~HazardPointer() {
+        Reset();
+        record_.used_mask &= ~(1u << index_);
+    }
+
+    // `load` returns the block currently published by the source. Returns a block that stays alive
+    // until `Reset`, or nullptr.
+    template <typename Load>
+    ControlBlockBase* Protect(Load load) {
+        ControlBlockBase* block = load();
+        while (true) {
+            // Release: a reclaimer that sees the slot change also sees the reads of the old block
+            Slot().store(block, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            ControlBlockBase* current = load();
+            if (current == block) {
+                return block;
+            }
+            block = current;
+        }
+    }
+
+    void Reset() {
+        Slot().store(nullptr, std::memory_order_release);
+        HazardDomain::Default().ReclaimIfRetired();
+    }
+
+private:
+    std::atomic<ControlBlockBase*>& Slot() {
+        return record_.slots[index_];
+    }
+
+    HazardDomain::Record& record_;
+    int index_ = 0;
+};
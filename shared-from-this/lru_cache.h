@@ -0,0 +1,211 @@
+#pragma once
+
+#include "shared.h"
+
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+
+// LRU cache of `SharedPtr` values under a budget in bytes, each entry charged what the caller says
+// it costs. Eviction skips the entries whose `UseCount()` is above one: somebody else still holds
+// the object, dropping it would free nothing. A skipped entry goes back to the front of its
+// segment, in use counts as used, so one eviction pass looks at every entry at most once. If all
+// of them are in use the cache stays over budget until they are released.
+//
+// Segmented LRU: new entries go to the probation segment and move to the protected one on their
+// first hit, so a scan of keys seen once does not flush the entries that are used again. The
+// protected segment gets `kProtectedPercent` of the budget, its least recent entries fall back to
+// probation. Eviction takes probation first. The links are in the map nodes, a hit does not
+// allocate. Not thread-safe.
+template <typename K, typename T, typename Hash = std::hash<K>, typename Equal = std::equal_to<K>>
+class SharedLruCache {
+public:
+    static constexpr size_t kProtectedPercent = 80;
+
+    explicit SharedLruCache(size_t budget) : budget_(budget) {
+    }
+
+    SharedLruCache(const SharedLruCache&) = delete;
+    SharedLruCache& operator=(const SharedLruCache&) = delete;
+
+    ~SharedLruCache() = default;
+
+    // Empty on a miss
+    SharedPtr<T> Find(const K& key) {
+        auto it = map_.find(key);
+        if (it == map_.end()) {
+            return SharedPtr<T>();
+        }
+        Entry& entry = it->second;
+        if (entry.is_protected) {
+            protected_.MoveToFront(&entry);
+        } else {
+            probation_.Unlink(&entry);
+            probation_charge_ -= entry.charge;
+            entry.is_protected = true;
+            protected_.PushFront(&entry);
+            protected_charge_ += entry.charge;
+            Demote();
+        }
+        return entry.value;
+    }
+
+    // Caches `value` as the cost of `charge` bytes, replacing the old value of `key`, and evicts
+    // down to the budget
+    void Insert(const K& key, SharedPtr<T> value, size_t charge) {
+        auto [it, inserted] = map_.try_emplace(key);
+        Entry& entry = it->second;
+        if (inserted) {
+            entry.key = &it->first;
+        } else {
+            Unlink(&entry);
+        }
+        entry.value = std::move(value);
+        entry.charge = charge;
+        entry.is_protected = false;
+        probation_.PushFront(&entry);
+        probation_charge_ += charge;
+        Evict();
+    }
+
+    // Charged as the size of `T`
+    void Insert(const K& key, SharedPtr<T> value) {
+        Insert(key, std::move(value), sizeof(T));
+    }
+
+    bool Erase(const K& key) {
+        auto it = map_.find(key);
+        if (it == map_.end()) {
+            return false;
+        }
+        Unlink(&it->second);
+        map_.erase(it);
+        return true;
+    }
+
+    void Clear() {
+        probation_.Clear();
+        protected_.Clear();
+        probation_charge_ = 0;
+        protected_charge_ = 0;
+        map_.clear();
+    }
+
+    // Evicts at once if the budget shrinks
+    void SetBudget(size_t budget) {
+        budget_ = budget;
+        Demote();
+        Evict();
+    }
+
+    size_t Budget() const {
+        return budget_;
+    }
+    // Bytes charged for the cached entries
+    size_t Charge() const {
+        return probation_charge_ + protected_charge_;
+    }
+    size_t Size() const {
+        return map_.size();
+    }
+
+private:
+    struct Node {
+        Node* prev = this;
+        Node* next = this;
+    };
+
+    struct Entry : Node {
+        const K* key = nullptr;  // in the same map node
+        SharedPtr<T> value;
+        size_t charge = 0;
+        bool is_protected = false;
+    };
+
+    // Circular, `head_` is the sentinel
+    class List {
+    public:
+        List() = default;
+        List(const List&) = delete;
+        List& operator=(const List&) = delete;
+
+        size_t Size() const {
+            return size_;
+        }
+        Entry* Back() {
+            return static_cast<Entry*>(head_.prev);
+        }
+        void PushFront(Entry* entry) {
+            entry->prev = &head_;
+            entry->next = head_.next;
+            head_.next->prev = entry;
+            head_.next = entry;
+            ++size_;
+        }
+        void Unlink(Entry* entry) {
+            entry->prev->next = entry->next;
+            entry->next->prev = entry->prev;
+            --size_;
+        }
+        void MoveToFront(Entry* entry) {
+            Unlink(entry);
+            PushFront(entry);
+        }
+        void Clear() {
+            head_.prev = head_.next = &head_;
+            size_ = 0;
+        }
+
+    private:
+        Node head_;
+        size_t size_ = 0;
+    };
+
+    void Unlink(Entry* entry) {
+        if (entry->is_protected) {
+            protected_.Unlink(entry);
+            protected_charge_ -= entry->charge;
+        } else {
+            probation_.Unlink(entry);
+            probation_charge_ -= entry->charge;
+        }
+    }
+
+    void Demote() {
+        // Does not overflow for a budget of SIZE_MAX, i.e. no limit
+        size_t limit = budget_ / 100 * kProtectedPercent + budget_ % 100 * kProtectedPercent / 100;
+        while (protected_charge_ > limit) {
+            Entry* entry = protected_.Back();
+            protected_.Unlink(entry);
+            protected_charge_ -= entry->charge;
+            entry->is_protected = false;
+            probation_.PushFront(entry);
+            probation_charge_ += entry->charge;
+        }
+    }
+
+    void Evict() {
+        EvictFrom(probation_);
+        EvictFrom(protected_);
+    }
+
+    void EvictFrom(List& list) {
+        // Counted up front, the skipped entries come round again
+        for (size_t count = list.Size(); count > 0 && Charge() > budget_; --count) {
+            Entry* entry = list.Back();
+            if (entry->value.UseCount() > 1) {
+                list.MoveToFront(entry);
+            } else {
+                Erase(*entry->key);
+            }
+        }
+    }
+
+    std::unordered_map<K, Entry, Hash, Equal> map_;  // the nodes do not move, the links stay valid
+    List probation_;
+    List protected_;
+    size_t probation_charge_ = 0;
+    size_t protected_charge_ = 0;
+    size_t budget_;
+};
@@ -1,8 +1,11 @@
 #include "shared.h"
+#include "thin.h"
 #include "weak.h"
 
 #include <catch.hpp>
 
+#include "allocations_checker.h"
+
 struct T : public EnableSharedFromThis<T> {};
 
 struct Y : T {};
@@ -22,6 +25,30 @@ struct Bar : public Foo {
     }
 };
 
+struct Session : EnableSharedFromBlock<Session> {
+    explicit Session(int id) : id(id) {
+        REQUIRE_THROWS_AS(SharedFromThis(), BadWeakPtr);
+        REQUIRE(!WeakFromThis().Lock());
+    }
+
+    int id;
+};
+
+// Like `std::enable_shared_from_this`, the object is unowned once its destructor runs
+struct DyingSession : EnableSharedFromBlock<DyingSession> {
+    ~DyingSession() {
+        weak_expired = WeakFromThis().Expired();
+        try {
+            SharedFromThis();
+        } catch (const BadWeakPtr&) {
+            shared_threw = true;
+        }
+    }
+
+    static inline bool weak_expired = false;
+    static inline bool shared_threw = false;
+};
+
 TEST_CASE("SharedFromThis") {
     {
         SharedPtr<T> t1(new T);
@@ -89,3 +116,61 @@ TEST_CASE("WeakFromThis") {
     REQUIRE(!weak.Expired());
     REQUIRE(weak.Lock().Get() == ptr);
 }
+
+TEST_CASE("SharedFromBlock") {
+    static_assert(sizeof(Session) == sizeof(int), "no stored WeakPtr");
+    // Elements would take the array block for their own, the block types reject them
+    static_assert(kSharedFromBlock<Session[]> && kSharedFromBlock<Session[3]>);
+
+    SharedPtr<Session> session;
+#ifndef SMART_POINTERS_POOLED_BLOCKS  // pooled blocks come from slabs shared by many blocks
+    EXPECT_ONE_ALLOCATION(session = MakeShared<Session>(7););
+#else
+    session = MakeShared<Session>(7);
+#endif
+    REQUIRE(session.UseCount() == 1);
+
+    auto shared = session->SharedFromThis();
+    REQUIRE(shared.Get() == session.Get());
+    REQUIRE(session.UseCount() == 2);
+    const Session* const_session = session.Get();
+    SharedPtr<const Session> const_shared = const_session->SharedFromThis();
+    REQUIRE(const_shared->id == 7);
+    REQUIRE(session.UseCount() == 3);
+
+    WeakPtr<Session> weak = session->WeakFromThis();
+    REQUIRE(weak.UseCount() == 3);
+    shared.Reset();
+    const_shared.Reset();
+    session.Reset();
+    REQUIRE(weak.Expired());
+
+    auto thin = MakeThinShared<Session>(8);
+    REQUIRE(thin->SharedFromThis().Get() == thin.Get());
+}
+
+TEST_CASE("SharedFromBlock in the destructor") {
+    // The sole owner without weak references takes the release fast path
+    SECTION("Sole owner") {
+        MakeShared<DyingSession>();
+    }
+    SECTION("Shared owners") {
+        auto first = MakeShared<DyingSession>();
+        auto second = first;
+        first.Reset();
+        second.Reset();
+    }
+    SECTION("Weak reference") {
+        auto session = MakeShared<DyingSession>();
+        WeakPtr<DyingSession> weak = session;
+        session.Reset();
+        REQUIRE(weak.Expired());
+    }
+    SECTION("Thin owner") {
+        MakeThinShared<DyingSession>();
+    }
+    REQUIRE(DyingSession::weak_expired);
+    REQUIRE(DyingSession::shared_threw);
+    DyingSession::weak_expired = false;
+    DyingSession::shared_threw = false;
+}
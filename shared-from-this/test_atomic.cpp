@@ -0,0 +1,304 @@
+#include "atomic_shared.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Config {
+    explicit Config(int version) : version(version), checksum(version * 7) {
+    }
+    ~Config() {
+        ++destroyed;
+    }
+
+    int version;
+    int checksum;
+
+    static std::atomic<int> destroyed;
+};
+
+std::atomic<int> Config::destroyed = 0;
+
+// Its block is reachable from the object, so a test can push the count to its limit
+struct Counter : EnableSharedFromBlock<Counter> {
+    ~Counter() {
+        ++destroyed;
+    }
+
+    static inline int destroyed = 0;
+};
+
+}  // namespace
+
+TEST_CASE("AtomicSharedPtr basics") {
+    STATIC_REQUIRE(AtomicSharedPtr<int>::kIsAlwaysLockFree);
+
+    SECTION("Empty") {
+        AtomicSharedPtr<int> a;
+        REQUIRE(a.Load().Get() == nullptr);
+        a.Store(nullptr);
+        REQUIRE(a.Load().Get() == nullptr);
+    }
+
+    SECTION("Load and Store") {
+        Config::destroyed = 0;
+        {
+            auto first = MakeShared<Config>(1);
+            AtomicSharedPtr<Config> a(first);
+            REQUIRE(a.Load().Get() == first.Get());
+            REQUIRE(a.Load()->version == 1);
+
+            a.Store(MakeShared<Config>(2));
+            REQUIRE(a.Load()->version == 2);
+            REQUIRE(first.UseCount() == 1);
+
+            auto loaded = a.Load();
+            a.Store(nullptr);
+            REQUIRE(Config::destroyed == 0);
+            REQUIRE(loaded->version == 2);
+            loaded.Reset();
+            REQUIRE(Config::destroyed == 1);
+        }
+        REQUIRE(Config::destroyed == 2);
+    }
+
+    SECTION("Exchange") {
+        AtomicSharedPtr<int> a(MakeShared<int>(1));
+        auto old = a.Exchange(MakeShared<int>(2));
+        REQUIRE(*old == 1);
+        REQUIRE(*a.Load() == 2);
+    }
+
+    SECTION("CompareExchange") {
+        auto first = MakeShared<int>(1);
+        AtomicSharedPtr<int> a(first);
+
+        auto expected = MakeShared<int>(1);  // same value, other object
+        REQUIRE_FALSE(a.CompareExchangeStrong(expected, MakeShared<int>(2)));
+        REQUIRE(expected.Get() == first.Get());
+
+        REQUIRE(a.CompareExchangeStrong(expected, MakeShared<int>(3)));
+        REQUIRE(*a.Load() == 3);
+
+        expected = a.Load();
+        REQUIRE(a.CompareExchangeWeak(expected, nullptr));
+        REQUIRE(a.Load().Get() == nullptr);
+
+        SharedPtr<int> empty;
+        REQUIRE(a.CompareExchangeStrong(empty, first));
+        REQUIRE(a.Load().Get() == first.Get());
+    }
+
+    SECTION("Loaded pointers own the object") {
+        auto value = MakeShared<int>(5);
+        AtomicSharedPtr<int> a(value);
+        auto loaded = a.Load();
+        REQUIRE(loaded.UseCount() == 3);  // `value`, `loaded` and the one stored in `a`
+        REQUIRE(value.UseCount() == 3);
+
+        WeakPtr<int> weak = loaded;
+        a.Store(MakeShared<int>(6));
+        REQUIRE(loaded.UseCount() == 2);
+        REQUIRE(!weak.Expired());
+        REQUIRE(weak.Lock() == value);
+
+        value.Reset();
+        loaded.Reset();
+        REQUIRE(weak.Expired());
+
+        auto old = a.Exchange(nullptr);
+        REQUIRE(old.UseCount() == 1);
+        REQUIRE(*old == 6);
+    }
+
+    SECTION("Load at the count limit") {
+        constexpr size_t kMaxCount = (size_t(1) << 31) - 1;
+        Counter::destroyed = 0;
+        auto value = MakeShared<Counter>();
+        AtomicSharedPtr<Counter> a(value);
+        ControlBlockBase* block = ControlBlockHolder<Counter>::FromPointer(value.Get());
+        block->IncStrongRefs(kMaxCount - 2);
+        REQUIRE_THROWS_AS(a.Load(), RefCountOverflow);
+        block->DecStrongRefs(kMaxCount - 2);
+
+        // The snapshot reference of the failed load is gone, so is the object with the last owner
+        value.Reset();
+        a.Store(nullptr);
+        REQUIRE(Counter::destroyed == 1);
+    }
+
+    SECTION("Many loads refill the count") {
+        auto value = MakeShared<int>(42);
+        AtomicSharedPtr<int> a(value);
+        std::vector<SharedPtr<int>> loads;
+        for (int i = 0; i < 100000; ++i) {
+            loads.push_back(a.Load());
+        }
+        a.Store(nullptr);
+        for (const auto& load : loads) {
+            REQUIRE(*load == 42);
+        }
+        loads.clear();
+        REQUIRE(value.UseCount() == 1);
+    }
+}
+
+TEST_CASE("AtomicWeakPtr basics") {
+    auto value = MakeShared<int>(42);
+    AtomicWeakPtr<int> a(value);
+    REQUIRE(*a.Load().Lock() == 42);
+
+    auto other = MakeShared<int>(7);
+    WeakPtr<int> expected = value;
+    REQUIRE(a.CompareExchangeStrong(expected, other));
+    REQUIRE(*a.Load().Lock() == 7);
+    REQUIRE_FALSE(a.CompareExchangeStrong(expected, value));
+
+    auto old = a.Exchange(WeakPtr<int>());
+    REQUIRE(*old.Lock() == 7);
+    REQUIRE(a.Load().Expired());
+
+    a.Store(other);
+    other.Reset();
+    REQUIRE(a.Load().Expired());
+}
+
+TEST_CASE("AtomicSharedPtr concurrent readers") {
+    Config::destroyed = 0;
+    constexpr int kVersions = 1000;
+    {
+        AtomicSharedPtr<Config> config(MakeShared<Config>(0));
+        std::atomic<bool> done = false;
+        std::atomic<bool> torn = false;
+
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 4; ++i) {
+            readers.emplace_back([&] {
+                int last = 0;
+                while (!done) {
+                    auto current = config.Load();
+                    if (current->checksum != current->version * 7 || current->version < last) {
+                        torn = true;
+                    }
+                    last = current->version;
+                }
+            });
+        }
+
+        std::thread writer([&] {
+            for (int version = 1; version < kVersions; ++version) {
+                config.Store(MakeShared<Config>(version));
+            }
+            done = true;
+        });
+
+        writer.join();
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        REQUIRE_FALSE(torn);
+        REQUIRE(config.Load()->version == kVersions - 1);
+    }
+    REQUIRE(Config::destroyed == kVersions);
+}
+
+TEST_CASE("AtomicSharedPtr concurrent CompareExchange") {
+    constexpr int kThreads = 4;
+    constexpr int kIncrements = 2000;
+    AtomicSharedPtr<int> counter(MakeShared<int>(0));
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; ++i) {
+        threads.emplace_back([&] {
+            for (int j = 0; j < kIncrements; ++j) {
+                auto expected = counter.Load();
+                while (!counter.CompareExchangeWeak(expected, MakeShared<int>(*expected + 1))) {
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(*counter.Load() == kThreads * kIncrements);
+}
+
+TEST_CASE("Hazard pointers") {
+    SECTION("Protected value outlives Store") {
+        Config::destroyed = 0;
+        AtomicSharedPtr<Config> config(MakeShared<Config>(1));
+        {
+            HazardPointer hazard;
+            Config* current = config.Protect(hazard);
+            REQUIRE(current->version == 1);
+
+            config.Store(MakeShared<Config>(2));
+            REQUIRE(Config::destroyed == 0);
+            REQUIRE(current->version == 1);
+
+            hazard.Reset();  // releases the retired snapshot
+            REQUIRE(Config::destroyed == 1);
+        }
+        config.Store(nullptr);
+        REQUIRE(Config::destroyed == 2);
+    }
+
+    SECTION("Empty and nested") {
+        AtomicSharedPtr<int> empty;
+        AtomicSharedPtr<int> value(MakeShared<int>(42));
+        HazardPointer first;
+        HazardPointer second;
+        REQUIRE(empty.Protect(first) == nullptr);
+        REQUIRE(*value.Protect(second) == 42);
+    }
+
+    SECTION("Slots run out") {
+        std::vector<std::unique_ptr<HazardPointer>> hazards;
+        for (int i = 0; i < HazardDomain::kSlotsPerThread; ++i) {
+            hazards.push_back(std::make_unique<HazardPointer>());
+        }
+        REQUIRE_THROWS_AS(HazardPointer(), HazardSlotsExhausted);
+        hazards.pop_back();
+        HazardPointer last;  // the freed slot is taken again
+        REQUIRE_THROWS_AS(HazardPointer(), HazardSlotsExhausted);
+    }
+
+    SECTION("Concurrent readers") {
+        Config::destroyed = 0;
+        constexpr int kVersions = 1000;
+        {
+            AtomicSharedPtr<Config> config(MakeShared<Config>(0));
+            std::atomic<bool> done = false;
+            std::atomic<bool> torn = false;
+
+            std::vector<std::thread> readers;
+            for (int i = 0; i < 4; ++i) {
+                readers.emplace_back([&] {
+                    HazardPointer hazard;
+                    while (!done) {
+                        Config* current = config.Protect(hazard);
+                        if (current->checksum != current->version * 7) {
+                            torn = true;
+                        }
+                    }
+                });
+            }
+            for (int version = 1; version < kVersions; ++version) {
+                config.Store(MakeShared<Config>(version));
+            }
+            done = true;
+            for (auto& reader : readers) {
+                reader.join();
+            }
+            REQUIRE_FALSE(torn);
+        }
+        REQUIRE(Config::destroyed == kVersions);
+    }
+}
@@ -0,0 +1,100 @@
+#include "lru_cache.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("SharedLruCache") {
+    SharedLruCache<int, std::string> cache(100);
+
+    SECTION("Budget") {
+        for (int i = 0; i < 10; ++i) {
+            cache.Insert(i, MakeShared<std::string>(std::to_string(i)), 20);
+        }
+        REQUIRE(cache.Size() == 5);
+        REQUIRE(cache.Charge() == 100);
+        REQUIRE(!cache.Find(4));
+        REQUIRE(*cache.Find(5) == "5");
+
+        cache.Insert(5, MakeShared<std::string>("five"), 50);  // replaces, charged anew
+        REQUIRE(*cache.Find(5) == "five");
+        REQUIRE(cache.Charge() <= 100);
+
+        cache.SetBudget(0);
+        REQUIRE(cache.Size() == 0);
+        REQUIRE(cache.Charge() == 0);
+    }
+
+    SECTION("Least recently used") {
+        for (int i = 0; i < 5; ++i) {
+            cache.Insert(i, MakeShared<std::string>(), 20);
+        }
+        cache.Find(0);
+        cache.Insert(5, MakeShared<std::string>(), 20);
+        REQUIRE(cache.Find(0));
+        REQUIRE(!cache.Find(1));
+        REQUIRE(cache.Find(2));
+    }
+
+    SECTION("Shared entries are skipped") {
+        auto held = MakeShared<std::string>("held");
+        cache.Insert(0, held, 50);
+        cache.Insert(1, MakeShared<std::string>("free"), 50);
+        cache.Insert(2, MakeShared<std::string>("new"), 50);
+        REQUIRE(cache.Find(0) == held);  // the oldest, but in use
+        REQUIRE(!cache.Find(1));
+        REQUIRE(cache.Find(2));
+
+        // Nothing to evict: over budget until the owners let go
+        auto other = cache.Find(2);
+        cache.Insert(3, held, 50);
+        REQUIRE(cache.Size() == 3);
+        REQUIRE(cache.Charge() == 150);
+        other.Reset();
+        held.Reset();
+        cache.SetBudget(100);
+        REQUIRE(cache.Charge() <= 100);
+    }
+
+    SECTION("Scans do not flush the protected segment") {
+        SharedLruCache<int, int> segmented(10);
+        for (int i = 0; i < 4; ++i) {
+            segmented.Insert(i, MakeShared<int>(i), 1);
+            segmented.Find(i);  // protected
+        }
+        for (int i = 100; i < 200; ++i) {  // seen once
+            segmented.Insert(i, MakeShared<int>(i), 1);
+        }
+        for (int i = 0; i < 4; ++i) {
+            REQUIRE(*segmented.Find(i) == i);
+        }
+        REQUIRE(segmented.Size() == 10);
+    }
+
+    SECTION("Hits do not allocate") {
+        cache.Insert(1, MakeShared<std::string>("one"), 10);
+        cache.Insert(2, MakeShared<std::string>("two"), 10);
+        int hits = 0;
+        EXPECT_ZERO_ALLOCATIONS(for (int i = 0; i < 100; ++i) { hits += !!cache.Find(1 + i % 2); });
+        REQUIRE(hits == 100);
+    }
+
+    SECTION("Erase and Clear") {
+        auto value = MakeShared<std::string>("value");
+        cache.Insert(1, value, 10);
+        cache.Insert(2, value, 10);
+        REQUIRE(value.UseCount() == 3);
+        REQUIRE(cache.Erase(1));
+        REQUIRE(!cache.Erase(1));
+        REQUIRE(cache.Charge() == 10);
+        cache.Clear();
+        REQUIRE(value.UseCount() == 1);
+        REQUIRE(cache.Charge() == 0);
+        cache.Insert(3, value);
+        REQUIRE(cache.Charge() == sizeof(std::string));
+    }
+}
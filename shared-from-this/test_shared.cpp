@@ -4,7 +4,14 @@
 
 #include "allocations_checker.h"
 
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <memory_resource>
+#include <thread>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -330,7 +337,11 @@ struct Throwing {
 
 TEST_CASE("MakeShared") {
     SECTION("One allocation") {
+#ifndef SMART_POINTERS_POOLED_BLOCKS  // pooled blocks come from slabs shared by many blocks
         EXPECT_ONE_ALLOCATION(REQUIRE(*MakeShared<int>(42) == 42));
+#else
+        REQUIRE(*MakeShared<int>(42) == 42);
+#endif
     }
 
     SECTION("Parameters passing") {
@@ -467,3 +478,542 @@ TEST_CASE("Destructor for correct type") {
         REQUIRE(B::destructor_called);
     }
 }
+
+struct Counted {
+    static std::atomic<int> destroyed;
+
+    ~Counted() {
+        destroyed.fetch_add(1);
+    }
+};
+
+std::atomic<int> Counted::destroyed = 0;
+
+TEST_CASE("Concurrent copies") {
+    SECTION("Copy and destroy from many threads") {
+        Counted::destroyed = 0;
+        {
+            SharedPtr<Counted> sp = MakeShared<Counted>();
+            std::vector<std::thread> threads;
+            for (int i = 0; i < 4; ++i) {
+                threads.emplace_back([&sp] {
+                    for (int j = 0; j < 100'000; ++j) {
+                        SharedPtr<Counted> copy = sp;
+                        SharedPtr<Counted> other = std::move(copy);
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            REQUIRE(sp.UseCount() == 1);
+            REQUIRE(Counted::destroyed == 0);
+        }
+        REQUIRE(Counted::destroyed == 1);
+    }
+
+    SECTION("Last owner on another thread") {
+        Counted::destroyed = 0;
+        for (int i = 0; i < 1000; ++i) {
+            SharedPtr<Counted> sp(new Counted);
+            std::thread thread([copy = sp]() mutable { copy.Reset(); });
+            sp.Reset();
+            thread.join();
+        }
+        REQUIRE(Counted::destroyed == 1000);
+    }
+}
+
+TEST_CASE("LocalSharedPtr") {
+    SECTION("Copy/move") {
+        Counted::destroyed = 0;
+        {
+            LocalSharedPtr<Counted> a = MakeLocalShared<Counted>();
+            LocalSharedPtr<Counted> b = a;
+            LocalSharedPtr<Counted> c(new Counted);
+            REQUIRE(a.UseCount() == 2);
+            c = std::move(b);
+            REQUIRE(Counted::destroyed == 1);
+            REQUIRE(a.UseCount() == 2);
+        }
+        REQUIRE(Counted::destroyed == 2);
+    }
+
+    SECTION("Conversion of the sole owner") {
+        Counted::destroyed = 0;
+        LocalSharedPtr<Counted> local = MakeLocalShared<Counted>();
+        Counted* ptr = local.Get();
+        SharedPtr<Counted> shared(std::move(local));
+        REQUIRE(!local);
+        REQUIRE(shared.Get() == ptr);
+        REQUIRE(shared.UseCount() == 1);
+
+        std::thread thread([copy = shared]() mutable { copy.Reset(); });
+        shared.Reset();
+        thread.join();
+        REQUIRE(Counted::destroyed == 1);
+    }
+
+    SECTION("Conversion of a shared block") {
+        LocalSharedPtr<int> local(new int(42));
+        LocalSharedPtr<int> copy = local;
+        REQUIRE_THROWS_AS(SharedPtr<int>(std::move(local)), BadSharedPtrConversion);
+        REQUIRE(local.UseCount() == 2);
+
+        copy.Reset();
+        SharedPtr<int> shared(std::move(local));
+        REQUIRE(*shared == 42);
+    }
+}
+
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    CountingAllocator(int* live_blocks) : live_blocks(live_blocks) {
+    }
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : live_blocks(other.live_blocks) {
+    }
+
+    T* allocate(size_t n) {
+        ++*live_blocks;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        --*live_blocks;
+        std::allocator<T>().deallocate(ptr, n);
+    }
+
+    int* live_blocks;
+};
+
+TEST_CASE("AllocateShared") {
+    SECTION("Block comes from the allocator") {
+        int live_blocks = 0;
+        {
+            auto sp = AllocateShared<std::string>(CountingAllocator<int>(&live_blocks), "aba");
+            REQUIRE(live_blocks == 1);
+            SharedPtr<std::string> copy = sp;
+            sp.Reset();
+            REQUIRE(*copy == "aba");
+            REQUIRE(live_blocks == 1);
+        }
+        REQUIRE(live_blocks == 0);
+    }
+
+    SECTION("Stateless allocator takes no space") {
+        REQUIRE(sizeof(ControlBlockAllocHolder<int, std::allocator<int>>) ==
+                sizeof(ControlBlockHolder<int>));
+    }
+
+    SECTION("Faulty constructor") {
+        int live_blocks = 0;
+        REQUIRE_THROWS(AllocateShared<Throwing>(CountingAllocator<int>(&live_blocks)));
+        REQUIRE(live_blocks == 0);
+    }
+
+    SECTION("Memory resource") {
+        alignas(std::max_align_t) char buffer[1024];
+        std::pmr::monotonic_buffer_resource resource(buffer, sizeof(buffer),
+                                                     std::pmr::null_memory_resource());
+        EXPECT_ZERO_ALLOCATIONS(auto sp = MakeSharedPmr<int>(&resource, 42); REQUIRE(*sp == 42));
+
+        auto vec = MakeSharedPmr<std::pmr::vector<int>>(&resource, 3, 1);
+        REQUIRE(vec->size() == 3);
+        REQUIRE(vec->get_allocator().resource() == &resource);
+    }
+}
+
+TEST_CASE("Arrays") {
+    SECTION("One allocation") {
+        EXPECT_ONE_ALLOCATION(auto sp = MakeShared<int[]>(100); REQUIRE(sp[99] == 0));
+        EXPECT_ONE_ALLOCATION(auto sp = MakeShared<int[10]>(); REQUIRE(sp[9] == 0));
+    }
+
+    SECTION("Initial value") {
+        auto sp = MakeShared<std::string[]>(3, "aba");
+        REQUIRE(sp[0] == "aba");
+        REQUIRE(sp[2] == "aba");
+
+        auto fixed = MakeShared<int[4]>(7);
+        REQUIRE(fixed[3] == 7);
+    }
+
+    SECTION("Every element is destroyed once") {
+        Counted::destroyed = 0;
+        {
+            auto sp = MakeShared<Counted[]>(5);
+            SharedPtr<Counted[]> copy = sp;
+            sp.Reset();
+            REQUIRE(Counted::destroyed == 0);
+        }
+        REQUIRE(Counted::destroyed == 5);
+
+        Counted::destroyed = 0;
+        {
+            SharedPtr<Counted[]> sp(new Counted[3]);
+            sp.Reset(new Counted[2]);
+            REQUIRE(Counted::destroyed == 3);
+        }
+        REQUIRE(Counted::destroyed == 5);
+    }
+
+    SECTION("Faulty constructor") {
+        REQUIRE_THROWS(MakeShared<Throwing[]>(3));
+    }
+
+    SECTION("Aliasing and conversions") {
+        SharedPtr<int[]> sp = MakeShared<int[]>(4, 1);
+        sp[2] = 42;
+        SharedPtr<int> element(sp, &sp[2]);
+        REQUIRE(*element == 42);
+        SharedPtr<const int[]> constant = sp;
+        REQUIRE(constant[2] == 42);
+        REQUIRE(sp.UseCount() == 3);
+    }
+
+    SECTION("For overwrite") {
+#ifndef SMART_POINTERS_TELEMETRY  // the first object of a type registers it, which allocates
+        EXPECT_ONE_ALLOCATION(auto sp = MakeSharedForOverwrite<double[]>(1 << 20); sp[0] = 1);
+#endif
+        auto fixed = MakeSharedForOverwrite<char[16]>();
+        fixed[15] = 'x';
+        REQUIRE(fixed[15] == 'x');
+        auto single = MakeSharedForOverwrite<int>();
+        *single = 42;
+        REQUIRE(*single == 42);
+    }
+}
+
+struct EmptyDeleter {
+    void operator()(int* ptr) const {
+        std::free(ptr);
+    }
+};
+
+TEST_CASE("Custom deleter") {
+    SECTION("Memory from malloc") {
+        SharedPtr<int> sp(static_cast<int*>(std::malloc(sizeof(int))), EmptyDeleter());
+        *sp = 42;
+        SharedPtr<int> copy = sp;
+        REQUIRE(copy.UseCount() == 2);
+    }
+
+    SECTION("Stateless deleter takes no space") {
+        REQUIRE(sizeof(ControlBlockDeleter<int, EmptyDeleter, std::allocator<int>>) ==
+                sizeof(ControlBlockPointer<int>));
+    }
+
+    SECTION("Called once by the last owner") {
+        int calls = 0;
+        int value = 42;
+        {
+            SharedPtr<int> sp(&value, [&calls](int*) { ++calls; });
+            SharedPtr<int> copy = sp;
+            sp.Reset();
+            REQUIRE(calls == 0);
+        }
+        REQUIRE(calls == 1);
+    }
+
+    SECTION("Move-only deleter") {
+        auto owner = std::make_unique<int>(7);
+        Counted::destroyed = 0;
+        {
+            SharedPtr<Counted> sp(new Counted, [owner = std::move(owner)](Counted* ptr) {
+                REQUIRE(*owner == 7);
+                delete ptr;
+            });
+        }
+        REQUIRE(Counted::destroyed == 1);
+    }
+
+    SECTION("Block from the allocator") {
+        int live_blocks = 0;
+        int calls = 0;
+        int value = 42;
+        {
+            SharedPtr<int> sp(&value, [&calls](int*) { ++calls; },
+                              CountingAllocator<int>(&live_blocks));
+            REQUIRE(live_blocks == 1);
+        }
+        REQUIRE(live_blocks == 0);
+        REQUIRE(calls == 1);
+    }
+}
+
+TEST_CASE("Biased reference counting") {
+    SECTION("Owner thread") {
+        Counted::destroyed = 0;
+        {
+            BiasedSharedPtr<Counted> sp = MakeBiasedShared<Counted>();
+            BiasedSharedPtr<Counted> copy = sp;
+            REQUIRE(sp.UseCount() == 2);
+            copy.Reset();
+            REQUIRE(sp.UseCount() == 1);
+        }
+        REQUIRE(Counted::destroyed == 1);
+    }
+
+    SECTION("Copies on other threads") {
+        Counted::destroyed = 0;
+        BiasedSharedPtr<Counted> sp = MakeBiasedShared<Counted>();
+        std::thread([&sp] {
+            BiasedSharedPtr<Counted> copy = sp;
+        }).join();
+        REQUIRE(sp.UseCount() == 1);
+        sp.Reset();
+        REQUIRE(Counted::destroyed == 1);
+    }
+
+    SECTION("Owner reference released elsewhere") {
+        Counted::destroyed = 0;
+        BiasedSharedPtr<Counted> sp = MakeBiasedShared<Counted>();
+        BiasedSharedPtr<Counted> copy = sp;  // counted by the owner
+        std::thread([moved = std::move(copy)]() mutable {
+            moved.Reset();  // the shared count goes below zero, the block is queued
+        }).join();
+        sp.Reset();
+        REQUIRE(Counted::destroyed == 0);
+        BiasedRefCount::MergeQueued();
+        REQUIRE(Counted::destroyed == 1);
+    }
+
+    SECTION("Owner thread exited") {
+        Counted::destroyed = 0;
+        BiasedSharedPtr<Counted> sp;
+        std::thread([&sp] {
+            sp = MakeBiasedShared<Counted>();
+        }).join();
+        REQUIRE(sp.UseCount() == 1);
+        sp.Reset();
+        REQUIRE(Counted::destroyed == 1);
+    }
+
+    SECTION("Concurrent copies") {
+        Counted::destroyed = 0;
+        BiasedSharedPtr<Counted> sp = MakeBiasedShared<Counted>();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&sp] {
+                for (int j = 0; j < 10000; ++j) {
+                    BiasedSharedPtr<Counted> copy = sp;
+                }
+            });
+        }
+        for (int j = 0; j < 10000; ++j) {
+            BiasedSharedPtr<Counted> copy = sp;
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(sp.UseCount() == 1);
+        sp.Reset();
+        REQUIRE(Counted::destroyed == 1);
+    }
+}
+
+TEST_CASE("Block pool") {
+    SECTION("Reuses freed blocks") {
+        void* first = BlockPool::Allocate(32);
+        BlockPool::Deallocate(first, 32);
+        void* second = BlockPool::Allocate(24);  // same size class
+        REQUIRE(second == first);
+        BlockPool::Deallocate(second, 24);
+    }
+
+    SECTION("Blocks freed on other threads") {
+        constexpr int kBlocks = 1000;
+        std::vector<void*> blocks;
+        for (int i = 0; i < kBlocks; ++i) {
+            blocks.push_back(BlockPool::Allocate(48));
+            std::memset(blocks.back(), i, 48);
+        }
+        std::thread([&blocks] {
+            for (void* block : blocks) {
+                BlockPool::Deallocate(block, 48);
+            }
+        }).join();  // the blocks go to the depot when the thread exits
+        for (int i = 0; i < kBlocks; ++i) {
+            BlockPool::Deallocate(BlockPool::Allocate(48), 48);
+        }
+    }
+
+    SECTION("Large and over-aligned blocks") {
+        void* large = BlockPool::Allocate(BlockPool::kMaxSize + 1);
+        BlockPool::Deallocate(large, BlockPool::kMaxSize + 1);
+
+        struct alignas(64) Aligned {
+            int value = 42;
+        };
+        auto sp = MakeShared<Aligned>();
+        REQUIRE(reinterpret_cast<uintptr_t>(sp.Get()) % 64 == 0);
+        REQUIRE(sp->value == 42);
+    }
+}
+
+TEST_CASE("Packed counters") {
+    SECTION("Layout") {
+#if !defined(SMART_POINTERS_TELEMETRY) && !defined(SMART_POINTERS_BLOCK_REGISTRY)  // both add fields
+        REQUIRE(sizeof(ControlBlockBase) == 2 * sizeof(void*));
+        REQUIRE(sizeof(ControlBlockPointer<int>) == 3 * sizeof(void*));
+#endif
+    }
+
+    SECTION("Overflow") {
+        constexpr size_t kMaxCount = (size_t(1) << 31) - 1;
+        ControlBlockBase* block = new ControlBlockHolder<int>(42);
+        block->IncStrongRefs(kMaxCount);
+        REQUIRE_THROWS_AS(block->IncStrongRef(), RefCountOverflow);
+        REQUIRE_THROWS_AS(block->IncStrongRefs(1), RefCountOverflow);
+        REQUIRE(!block->TryIncStrongRef());
+        REQUIRE(block->GetStrongRefCount() == kMaxCount);
+        REQUIRE(block->GetWeakRefCount() == 1);  // held by the strong references
+
+        REQUIRE(block->DecStrongRefs(kMaxCount));
+        block->DeallocateBlock();
+    }
+
+    SECTION("Implicit weak reference") {
+        ControlBlockBase* block = new ControlBlockHolder<int>(42);
+        block->IncStrongRef();
+        REQUIRE(block->GetWeakRefCount() == 1);
+        block->IncStrongRef();
+        block->IncWeakRef();
+        REQUIRE(!block->ReleaseStrongRef());
+        REQUIRE(!block->ReleaseStrongRef());  // the weak reference keeps the block
+        REQUIRE(block->GetStrongRefCount() == 0);
+        REQUIRE(!block->IncStrongRefIfNotZero());
+        REQUIRE(block->DecWeakRef());
+        block->DeallocateBlock();
+
+        block = new ControlBlockHolder<int>(42);
+        block->IncStrongRef();
+        REQUIRE(block->IsUnique());
+        REQUIRE(block->ReleaseStrongRef());
+        block->DeallocateBlock();
+    }
+}
+
+struct BigCounted : Counted {
+    char payload[SMART_POINTERS_SEPARATE_STORAGE_THRESHOLD] = {};
+};
+
+TEST_CASE("Separate object storage") {
+    SECTION("Only large objects") {
+        REQUIRE(!kSeparateObjectStorage<int>);
+        REQUIRE(kSeparateObjectStorage<BigCounted>);
+#if !defined(SMART_POINTERS_TELEMETRY) && !defined(SMART_POINTERS_BLOCK_REGISTRY)  // both add fields
+        REQUIRE(sizeof(ControlBlockHolder<BigCounted>) == 3 * sizeof(void*));
+#endif
+    }
+
+    SECTION("Freed with the last strong reference") {
+        Counted::destroyed = 0;
+        ControlBlockBase* block = new ControlBlockHolder<BigCounted>();
+        block->IncStrongRef();
+        block->IncWeakRef();
+        REQUIRE(!block->ReleaseStrongRef());
+        REQUIRE(Counted::destroyed == 1);  // ASan checks the storage is gone as well
+        REQUIRE(block->DecWeakRef());
+        block->DeallocateBlock();
+        REQUIRE(Counted::destroyed == 1);
+    }
+
+    SECTION("MakeShared") {
+        auto sp = MakeShared<BigCounted>();
+        REQUIRE(sp->payload[0] == 0);
+        auto copy = sp;
+        REQUIRE(copy.Get() == sp.Get());
+        sp = MakeSharedForOverwrite<BigCounted>();
+        REQUIRE(copy.Get() != sp.Get());
+    }
+
+    SECTION("Faulty constructor") {
+        struct BigThrowing {
+            BigThrowing() {
+                throw 42;
+            }
+            char payload[SMART_POINTERS_SEPARATE_STORAGE_THRESHOLD];
+        };
+        REQUIRE_THROWS_AS(MakeShared<BigThrowing>(), int);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct ThrowingQueue {
+    void push_back(const SharedPtr<int>& ptr) {
+        if (items.size() == 3) {
+            throw 42;
+        }
+        items.push_back(ptr);
+    }
+    using value_type = SharedPtr<int>;
+
+    std::vector<SharedPtr<int>> items;
+};
+
+TEST_CASE("Batch references") {
+    SECTION("CloneN") {
+        auto sp = MakeShared<int>(42);
+        std::vector<SharedPtr<int>> copies(5);
+        REQUIRE(sp.CloneN(5, copies.begin()) == copies.end());
+        REQUIRE(sp.UseCount() == 6);
+        for (const auto& copy : copies) {
+            REQUIRE(copy.Get() == sp.Get());
+        }
+
+        SharedPtr<int> empty;
+        empty.CloneN(2, copies.begin());
+        REQUIRE(!copies[0]);
+        REQUIRE(sp.UseCount() == 4);
+    }
+
+    SECTION("Failing output") {
+        auto sp = MakeShared<int>(42);
+        ThrowingQueue queue;
+        REQUIRE_THROWS_AS(sp.CloneN(10, std::back_inserter(queue)), int);
+        REQUIRE(queue.items.size() == 3);
+        REQUIRE(sp.UseCount() == 4);
+    }
+
+    SECTION("ReleaseAll") {
+        Counted::destroyed = 0;
+        auto first = MakeShared<Counted>();
+        auto second = MakeShared<Counted>();
+        std::vector<SharedPtr<Counted>> copies;
+        first.CloneN(3, std::back_inserter(copies));
+        copies.emplace_back();
+        second.CloneN(2, std::back_inserter(copies));
+        first.CloneN(1, std::back_inserter(copies));
+        second.Reset();
+
+        SharedPtr<Counted>::ReleaseAll(copies.begin(), copies.end());
+        REQUIRE(first.UseCount() == 1);
+        REQUIRE(Counted::destroyed == 1);
+        for (const auto& copy : copies) {
+            REQUIRE(!copy);
+        }
+    }
+
+    SECTION("LocalSharedPtr") {
+        auto sp = MakeLocalShared<int>(42);
+        std::vector<LocalSharedPtr<int>> copies(3);
+        sp.CloneN(3, copies.begin());
+        REQUIRE(sp.UseCount() == 4);
+        LocalSharedPtr<int>::ReleaseAll(copies.begin(), copies.end());
+        REQUIRE(sp.UseCount() == 1);
+    }
+
+    SECTION("Overflow") {
+        auto sp = MakeShared<int>(42);
+        std::vector<SharedPtr<int>> copies;
+        REQUIRE_THROWS_AS(sp.CloneN(size_t(1) << 32, std::back_inserter(copies)),
+                          RefCountOverflow);
+        REQUIRE(sp.UseCount() == 1);
+    }
+}
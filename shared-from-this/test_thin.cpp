@@ -0,0 +1,169 @@
+#include "thin.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <string>
+#include <type_traits>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Node {
+    explicit Node(int value) : value(value) {
+    }
+    ~Node() {
+        ++destroyed;
+    }
+
+    int value;
+    std::string name = "node";
+
+    static int destroyed;
+};
+
+int Node::destroyed = 0;
+
+struct Big {
+    char payload[2 * SMART_POINTERS_SEPARATE_STORAGE_THRESHOLD] = {};
+    int value = 7;
+};
+
+struct Self : EnableSharedFromThis<Self> {
+    int value = 3;
+};
+
+struct ListNode {
+    int value = 0;
+    ThinSharedPtr<ListNode> next;
+    ThinWeakPtr<ListNode> prev;
+};
+
+}  // namespace
+
+static_assert(sizeof(ThinSharedPtr<Node>) == sizeof(void*));
+static_assert(sizeof(ThinWeakPtr<Node>) == sizeof(void*));
+static_assert(std::is_nothrow_move_constructible_v<ThinSharedPtr<Node>>);
+static_assert(std::is_nothrow_move_constructible_v<ThinWeakPtr<Node>>);
+static_assert(kTriviallyRelocatable<ThinSharedPtr<Node>>);
+static_assert(kTriviallyRelocatable<ThinWeakPtr<Node>>);
+
+TEST_CASE("ThinSharedPtr") {
+    SECTION("Ownership") {
+        Node::destroyed = 0;
+        ThinSharedPtr<Node> empty;
+        REQUIRE(!empty);
+        REQUIRE(empty.Get() == nullptr);
+        REQUIRE(empty.UseCount() == 0);
+
+        ThinSharedPtr<Node> a;
+#ifndef SMART_POINTERS_POOLED_BLOCKS  // pooled blocks come from slabs shared by many blocks
+        EXPECT_ALLOCATIONS(1, a = MakeThinShared<Node>(42););
+#else
+        a = MakeThinShared<Node>(42);
+#endif
+        REQUIRE(a->value == 42);
+        REQUIRE((*a).name == "node");
+        REQUIRE(a.UseCount() == 1);
+
+        auto b = a;
+        REQUIRE(b == a);
+        REQUIRE(a.UseCount() == 2);
+        auto c = std::move(b);
+        REQUIRE(!b);
+        REQUIRE(a.UseCount() == 2);
+        c = c;
+        c.Swap(empty);
+        REQUIRE(!c);
+        REQUIRE(empty.Get() == a.Get());
+
+        a.Reset();
+        REQUIRE(Node::destroyed == 0);
+        empty = nullptr;
+        REQUIRE(Node::destroyed == 1);
+    }
+
+    SECTION("Separate storage") {
+        auto big = MakeThinShared<Big>();
+        REQUIRE(big->value == 7);
+        ThinWeakPtr<Big> weak(big);
+        big.Reset();
+        REQUIRE(weak.Expired());
+    }
+}
+
+TEST_CASE("Thin list") {
+    auto head = MakeThinShared<ListNode>();
+    auto tail = head;
+    for (int i = 1; i < 100; ++i) {
+        auto node = MakeThinShared<ListNode>();
+        node->value = i;
+        node->prev = tail;
+        tail->next = node;
+        tail = node;
+    }
+    REQUIRE(tail->prev.Lock()->value == 98);
+
+    int sum = 0;
+    for (auto node = head; node; node = node->next) {
+        sum += node->value;
+    }
+    REQUIRE(sum == 99 * 100 / 2);
+}
+
+TEST_CASE("ThinWeakPtr") {
+    Node::destroyed = 0;
+    ThinWeakPtr<Node> weak;
+    REQUIRE(weak.Expired());
+    REQUIRE(!weak.Lock());
+    {
+        auto shared = MakeThinShared<Node>(1);
+        weak = shared;
+        auto copy = weak;
+        REQUIRE(copy.UseCount() == 1);
+        auto locked = copy.Lock();
+        REQUIRE(locked == shared);
+        REQUIRE(shared.UseCount() == 2);
+    }
+    REQUIRE(Node::destroyed == 1);
+    REQUIRE(weak.Expired());
+    REQUIRE(!weak.Lock());
+
+    auto moved = std::move(weak);
+    REQUIRE(moved.UseCount() == 0);
+}
+
+TEST_CASE("Conversions of thin pointers") {
+    SECTION("SharedPtr") {
+        auto thin = MakeThinShared<Node>(5);
+        auto full = static_cast<SharedPtr<Node>>(thin);
+        REQUIRE(full.Get() == thin.Get());
+        REQUIRE(thin.UseCount() == 2);
+
+        SharedPtr<std::string> name(full, &full->name);  // aliasing goes through the full pointer
+        full.Reset();
+        thin.Reset();
+        REQUIRE(*name == "node");
+        REQUIRE(name.UseCount() == 1);
+
+        REQUIRE(!static_cast<SharedPtr<Node>>(ThinSharedPtr<Node>()));
+    }
+
+    SECTION("WeakPtr") {
+        auto thin = MakeThinShared<Node>(6);
+        ThinWeakPtr<Node> thin_weak(thin);
+        auto weak = static_cast<WeakPtr<Node>>(thin_weak);
+        REQUIRE(weak.Lock()->value == 6);
+        thin.Reset();
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("EnableSharedFromThis") {
+        auto thin = MakeThinShared<Self>();
+        auto shared = thin->SharedFromThis();
+        REQUIRE(shared.Get() == thin.Get());
+        REQUIRE(thin.UseCount() == 2);
+    }
+}
@@ -5,6 +5,10 @@
 
 #include <catch.hpp>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 TEST_CASE("Empty weak") {
@@ -163,3 +167,93 @@ TEST_CASE("Lifetimes") {
         delete wp;
     }
 }
+
+TEST_CASE("Concurrent Lock") {
+    for (int i = 0; i < 1000; ++i) {
+        auto sp = MakeShared<std::string>("aba");
+        WeakPtr<std::string> wp(sp);
+        bool saw_garbage = false;
+        std::thread thread([wp, &saw_garbage] {
+            while (auto locked = wp.Lock()) {
+                saw_garbage |= *locked != "aba";
+            }
+        });
+        sp.Reset();
+        thread.join();
+        REQUIRE(!saw_garbage);
+        REQUIRE(wp.Expired());
+    }
+}
+
+TEST_CASE("TryLock") {
+    WeakPtr<std::string> empty;
+    REQUIRE(!empty.TryLock());
+    REQUIRE(!SharedPtr<std::string>(empty, std::nothrow));
+
+    auto sp = MakeShared<std::string>("aba");
+    WeakPtr<std::string> wp(sp);
+    auto locked = wp.TryLock();
+    REQUIRE(*locked == "aba");
+    REQUIRE(sp.UseCount() == 2);
+    SharedPtr<std::string> promoted(wp, std::nothrow);
+    REQUIRE(promoted.Get() == sp.Get());
+    REQUIRE(sp.UseCount() == 3);
+
+    sp.Reset();
+    locked.Reset();
+    promoted.Reset();
+    REQUIRE(!wp.TryLock());
+    REQUIRE(!SharedPtr<std::string>(wp, std::nothrow));
+    REQUIRE_THROWS_AS(SharedPtr<std::string>(wp), BadWeakPtr);
+}
+
+TEST_CASE("Concurrent TryLock never revives") {
+    struct Tracked {
+        explicit Tracked(std::atomic<bool>& destroyed) : destroyed(destroyed) {
+        }
+        ~Tracked() {
+            destroyed = true;
+        }
+        std::atomic<bool>& destroyed;
+    };
+    for (int i = 0; i < 200; ++i) {
+        std::atomic<bool> destroyed = false;
+        std::atomic<bool> revived = false;
+        auto sp = MakeShared<Tracked>(destroyed);
+        WeakPtr<Tracked> wp(sp);
+        std::vector<std::thread> threads;
+        for (int j = 0; j < 4; ++j) {
+            threads.emplace_back([wp, &destroyed, &revived] {
+                while (true) {
+                    bool was_destroyed = destroyed.load();
+                    auto locked = wp.TryLock();
+                    if (!locked) {
+                        return;
+                    }
+                    revived = revived || was_destroyed || locked->destroyed.load();
+                }
+            });
+        }
+        sp.Reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(!revived);
+        REQUIRE(destroyed);
+    }
+}
+
+TEST_CASE("Weak references do not pin large objects") {
+    struct Big : MyInt {
+        char payload[SMART_POINTERS_SEPARATE_STORAGE_THRESHOLD] = {};
+    };
+    WeakPtr<Big> wp;
+    {
+        auto sp = MakeShared<Big>();
+        wp = sp;
+        REQUIRE(MyInt::AliveCount() == 1);
+    }
+    REQUIRE(MyInt::AliveCount() == 0);
+    REQUIRE(wp.Expired());
+    REQUIRE(!wp.Lock());
+}
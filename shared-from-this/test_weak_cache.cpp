@@ -0,0 +1,169 @@
+#include "weak_cache.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("WeakValueCache") {
+    WeakValueCache<int, std::string> cache;
+
+    SECTION("Lookups") {
+        REQUIRE(!cache.Find(1));
+        auto value = MakeShared<std::string>("one");
+        cache.Insert(1, value);
+        REQUIRE(cache.Find(1) == value);
+        REQUIRE(value.UseCount() == 1);  // the cache does not own it
+
+        value.Reset();
+        REQUIRE(cache.Size() == 1);
+        REQUIRE(!cache.Find(1));
+        REQUIRE(cache.Size() == 0);  // erased by the failed lock
+
+        cache.Insert(2, MakeShared<std::string>("two"));
+        REQUIRE(cache.Erase(2));
+        REQUIRE(!cache.Erase(2));
+    }
+
+    SECTION("FindOrCreate") {
+        int created = 0;
+        auto factory = [&created] {
+            ++created;
+            return MakeShared<std::string>("value");
+        };
+        auto first = cache.FindOrCreate(7, factory);
+        auto second = cache.FindOrCreate(7, factory);
+        REQUIRE(first == second);
+        REQUIRE(created == 1);
+
+        first.Reset();
+        second.Reset();
+        auto third = cache.FindOrCreate(7, factory);
+        REQUIRE(*third == "value");
+        REQUIRE(created == 2);
+
+        REQUIRE_THROWS_AS(cache.FindOrCreate(8, []() -> SharedPtr<std::string> {
+            throw std::runtime_error("no value");
+        }),
+                          std::runtime_error);
+        REQUIRE(cache.Size() == 1);
+    }
+
+    SECTION("Reentrant factory") {
+        // The factory sweeps and inserts through the cache, which erases expired entries and
+        // rehashes while the outer call is in progress
+        std::vector<SharedPtr<std::string>> owners;
+        for (int i = 0; i < 100; ++i) {
+            auto outer = cache.FindOrCreate(i, [&] {
+                for (int j = 0; j < 10; ++j) {
+                    cache.Insert(1000 + i * 10 + j, MakeShared<std::string>("expired"));
+                }
+                owners.push_back(cache.FindOrCreate(-1 - i, [] {
+                    return MakeShared<std::string>("inner");
+                }));
+                return MakeShared<std::string>(std::to_string(i));
+            });
+            REQUIRE(*outer == std::to_string(i));
+            REQUIRE(cache.Find(i) == outer);
+            owners.push_back(outer);
+        }
+        for (int i = 0; i < 100; ++i) {
+            REQUIRE(*cache.Find(i) == std::to_string(i));
+            REQUIRE(*cache.Find(-1 - i) == "inner");
+        }
+    }
+
+    SECTION("Incremental purge") {
+        std::vector<SharedPtr<std::string>> owners;
+        for (int i = 0; i < 1000; ++i) {
+            owners.push_back(MakeShared<std::string>(std::to_string(i)));
+            cache.Insert(i, owners.back());
+        }
+        for (int i = 0; i < 1000; i += 2) {
+            owners[i].Reset();
+        }
+        REQUIRE(cache.Size() == 1000);
+
+        // Bounded work per call, and a full turn of the cursor finds all of them
+        size_t erased = 0;
+        size_t calls = 0;
+        while (cache.Size() > 500) {
+            erased += cache.Purge(WeakValueCache<int, std::string>::kDefaultPurgeStep);
+            ++calls;
+        }
+        REQUIRE(erased == 500);
+        REQUIRE(calls > 1);
+        for (int i = 1; i < 1000; i += 2) {
+            REQUIRE(*cache.Find(i) == std::to_string(i));
+        }
+
+        // The sweep keeps up with plain lookups too
+        owners.clear();
+        for (int i = 0; i < 1000; ++i) {
+            cache.Find(-1);
+        }
+        REQUIRE(cache.Size() == 0);
+    }
+}
+
+TEST_CASE("ShardedWeakValueCache") {
+    ShardedWeakValueCache<int, int> cache;
+    auto value = MakeShared<int>(42);
+    cache.Insert(1, value);
+    REQUIRE(cache.Find(1) == value);
+    REQUIRE(cache.Erase(1));
+    REQUIRE(!cache.Find(1));
+
+    SECTION("Reentrant factory") {
+        auto outer = cache.FindOrCreate(1, [&cache] {
+            REQUIRE(!cache.Find(1));  // same shard
+            return cache.FindOrCreate(1, [] { return MakeShared<int>(5); });
+        });
+        REQUIRE(*outer == 5);
+        REQUIRE(cache.Find(1) == outer);
+    }
+
+    SECTION("Concurrent FindOrCreate") {
+        constexpr int kKeys = 64;
+        std::atomic<int> created = 0;
+        std::vector<SharedPtr<int>> owners(kKeys);  // keep the values alive across threads
+        for (int key = 0; key < kKeys; ++key) {
+            owners[key] = cache.FindOrCreate(key, [&created, key] {
+                ++created;
+                return MakeShared<int>(key);
+            });
+        }
+
+        std::vector<std::thread> threads;
+        std::atomic<bool> mismatch = false;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&] {
+                for (int i = 0; i < 10000; ++i) {
+                    int key = i % kKeys;
+                    auto found = cache.FindOrCreate(key, [&created, key] {
+                        ++created;
+                        return MakeShared<int>(key);
+                    });
+                    if (*found != key) {
+                        mismatch = true;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(!mismatch);
+        REQUIRE(created == kKeys);
+        REQUIRE(cache.Size() == kKeys);
+
+        owners.clear();
+        REQUIRE(cache.Purge(1 << 20) == kKeys);
+        REQUIRE(cache.Size() == 0);
+    }
+}
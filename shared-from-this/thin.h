@@ -0,0 +1,267 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <common/relocate.h>
+
+#include <cstddef>  // std::nullptr_t
+#include <type_traits>
+#include <utility>
+
+// Pointers to objects from `MakeThinShared`, one word instead of two: the block is always a
+// `ControlBlockHolder<T>`, so the object is found from the block, at a fixed offset unless `T` is
+// large enough for `kSeparateObjectStorage`. For pointer-dense graphs and containers. There is no
+// aliasing and no conversion to a base, use the explicit conversion to `SharedPtr` for that.
+template <typename T>
+class ThinSharedPtr {
+    static_assert(!std::is_array_v<T>, "use SharedPtr for arrays");
+
+public:
+    using element_type = T;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    ThinSharedPtr() {
+    }
+    ThinSharedPtr(std::nullptr_t) {
+    }
+
+    ThinSharedPtr(const ThinSharedPtr& other) : block_(other.block_) {
+        if (block_) {
+            block_->IncStrongRef();
+        }
+    }
+
+    ThinSharedPtr(ThinSharedPtr&& other) noexcept : block_(std::exchange(other.block_, nullptr)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    ThinSharedPtr& operator=(const ThinSharedPtr& other) {
+        auto block = other.block_;  // `other` may be `*this`
+        if (block) {
+            block->IncStrongRef();
+        }
+        Dispose();
+        block_ = block;
+        return *this;
+    }
+
+    ThinSharedPtr& operator=(ThinSharedPtr&& other) noexcept {
+        if (this != &other) {
+            Dispose();
+            block_ = std::exchange(other.block_, nullptr);
+        }
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ThinSharedPtr() {
+        Dispose();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        Dispose();
+        block_ = nullptr;
+    }
+    void Swap(ThinSharedPtr& other) noexcept {
+        std::swap(block_, other.block_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return block_ ? GetPointer(block_) : nullptr;
+    }
+    T& operator*() const {
+        return *GetPointer(block_);
+    }
+    T* operator->() const {
+        return GetPointer(block_);
+    }
+    size_t UseCount() const {
+        if (block_) {
+            return block_->GetStrongRefCount();
+        }
+        return 0;
+    }
+    explicit operator bool() const {
+        return block_ != nullptr;
+    }
+
+    // Shares ownership with a full pointer, e.g. to alias a member or to convert to a base
+    explicit operator SharedPtr<T>() const {
+        SharedPtr<T> s;
+        if (block_) {
+            block_->IncStrongRef();
+            s.ptr_ = GetPointer(block_);
+            s.block_ = block_;
+        }
+        return s;
+    }
+
+private:
+    // A `ControlBlockHolder<T>`, which needs a complete `T`, so only the functions name it: the
+    // pointer may be declared while `T` is incomplete, e.g. as a member of `T`
+    ControlBlockBase* block_ = nullptr;
+
+    static T* GetPointer(ControlBlockBase* block) {
+        return static_cast<ControlBlockHolder<T>*>(block)->GetPointer();
+    }
+
+    void Dispose() {
+        if (block_) {
+            if (block_->ReleaseStrongRef()) {  // we held the last reference of any kind
+                block_->DeallocateBlock();
+            }
+            block_ = nullptr;
+        }
+    }
+
+    template <typename Y>
+    friend class ThinWeakPtr;
+
+    template <typename P, typename... Args>
+    friend ThinSharedPtr<P> MakeThinShared(Args&&... args);
+};
+
+template <typename T>
+class ThinWeakPtr {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    ThinWeakPtr() {
+    }
+
+    ThinWeakPtr(const ThinWeakPtr& other) : block_(other.block_) {
+        if (block_) {
+            block_->IncWeakRef();
+        }
+    }
+
+    ThinWeakPtr(ThinWeakPtr&& other) noexcept : block_(std::exchange(other.block_, nullptr)) {
+    }
+
+    // Demote `ThinSharedPtr`
+    ThinWeakPtr(const ThinSharedPtr<T>& other) : block_(other.block_) {
+        if (block_) {
+            block_->IncWeakRef();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    ThinWeakPtr& operator=(const ThinWeakPtr& other) {
+        auto block = other.block_;  // `other` may be `*this`
+        if (block) {
+            block->IncWeakRef();
+        }
+        Dispose();
+        block_ = block;
+        return *this;
+    }
+
+    ThinWeakPtr& operator=(ThinWeakPtr&& other) noexcept {
+        if (this != &other) {
+            Dispose();
+            block_ = std::exchange(other.block_, nullptr);
+        }
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ThinWeakPtr() {
+        Dispose();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        Dispose();
+        block_ = nullptr;
+    }
+    void Swap(ThinWeakPtr& other) noexcept {
+        std::swap(block_, other.block_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t UseCount() const {
+        if (block_) {
+            return block_->GetStrongRefCount();
+        }
+        return 0;
+    }
+    bool Expired() const {
+        return UseCount() == 0;
+    }
+    ThinSharedPtr<T> Lock() const noexcept {
+        ThinSharedPtr<T> s;
+        if (block_ && block_->TryIncStrongRef()) {
+            s.block_ = block_;
+        }
+        return s;
+    }
+
+    explicit operator WeakPtr<T>() const {
+        WeakPtr<T> w;
+        if (block_) {
+            block_->IncWeakRef();
+            w.ptr_ = ThinSharedPtr<T>::GetPointer(block_);
+            w.block_ = block_;
+        }
+        return w;
+    }
+
+private:
+    ControlBlockBase* block_ = nullptr;
+
+    void Dispose() {
+        if (block_) {
+            if (block_->DecWeakRef()) {
+                block_->DeallocateBlock();
+            }
+            block_ = nullptr;
+        }
+    }
+};
+
+// One pointer to the block, see common/relocate.h
+template <typename T>
+inline constexpr bool kTriviallyRelocatable<ThinSharedPtr<T>> = true;
+
+template <typename T>
+inline constexpr bool kTriviallyRelocatable<ThinWeakPtr<T>> = true;
+
+template <typename T>
+inline bool operator==(const ThinSharedPtr<T>& left, const ThinSharedPtr<T>& right) {
+    return left.Get() == right.Get();
+}
+
+// Same as `MakeShared`, the block is the same too
+template <typename T, typename... Args>
+ThinSharedPtr<T> MakeThinShared(Args&&... args) {
+    ThinSharedPtr<T> s;
+    auto block = new ControlBlockHolder<T>(std::forward<Args>(args)...);
+    s.block_ = block;
+    s.block_->IncStrongRef();
+    if constexpr (std::is_convertible_v<T*, EnableSharedFromThisBase*>) {
+        static_cast<SharedPtr<T>>(s).InitWeakThis(block->GetPointer());
+    }
+    return s;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+// Lookup cache whose values live only while somebody else owns them: the map holds `WeakPtr`s and
+// a lookup locks. An expired entry still pins its control block, and the object too when it is
+// stored inline, so every operation also sweeps a few buckets and erases the expired entries there.
+// The sweep goes round the table with a cursor, work per operation is bounded and there is never a
+// pass over the whole map. Not thread-safe, see `ShardedWeakValueCache`.
+template <typename K, typename T, typename Hash = std::hash<K>, typename Equal = std::equal_to<K>>
+class WeakValueCache {
+public:
+    // Buckets swept per operation. With the default load factor of 1 and one insertion per
+    // operation at most, 2 sweeps the table faster than it fills.
+    static constexpr size_t kDefaultPurgeStep = 2;
+
+    explicit WeakValueCache(size_t purge_step = kDefaultPurgeStep) : purge_step_(purge_step) {
+    }
+
+    // Empty on a miss or if the value is gone, the latter entry is erased right away
+    SharedPtr<T> Find(const K& key) {
+        Purge(purge_step_);
+        auto it = map_.find(key);
+        if (it == map_.end()) {
+            return SharedPtr<T>();
+        }
+        SharedPtr<T> value = it->second.TryLock();
+        if (!value) {
+            map_.erase(it);
+        }
+        return value;
+    }
+
+    // The live value of `key`, or a new one from `factory()`, which is then cached
+    template <typename Factory>
+    SharedPtr<T> FindOrCreate(const K& key, Factory&& factory) {
+        Purge(purge_step_);
+        auto it = map_.find(key);
+        if (it != map_.end()) {
+            if (SharedPtr<T> value = it->second.TryLock()) {
+                return value;
+            }
+        }
+        // Nothing of the map is held across the call: the factory may use the cache itself, and
+        // the sweep of a nested operation may erase the entry of `key` or rehash
+        SharedPtr<T> value = std::forward<Factory>(factory)();
+        map_.insert_or_assign(key, WeakPtr<T>(value));
+        return value;
+    }
+
+    void Insert(const K& key, const SharedPtr<T>& value) {
+        Purge(purge_step_);
+        map_.insert_or_assign(key, WeakPtr<T>(value));
+    }
+
+    bool Erase(const K& key) {
+        return map_.erase(key) != 0;
+    }
+
+    void Clear() {
+        map_.clear();
+        cursor_ = 0;
+    }
+
+    // Sweeps the next `buckets` buckets, returns the number of erased entries
+    size_t Purge(size_t buckets) {
+        size_t erased = 0;
+        size_t count = map_.bucket_count();
+        buckets = std::min(buckets, count);
+        for (size_t i = 0; i < buckets; ++i) {
+            size_t bucket = cursor_++ % count;  // a rehash only moves the cursor elsewhere
+            while (true) {
+                auto it = std::find_if(map_.begin(bucket), map_.end(bucket), [](const auto& entry) {
+                    return entry.second.Expired();
+                });
+                if (it == map_.end(bucket)) {
+                    break;
+                }
+                map_.erase(map_.find(it->first));  // the local iterator cannot be erased
+                ++erased;
+            }
+        }
+        return erased;
+    }
+
+    // Expired entries included until they are swept
+    size_t Size() const {
+        return map_.size();
+    }
+
+private:
+    std::unordered_map<K, WeakPtr<T>, Hash, Equal> map_;
+    size_t purge_step_;
+    size_t cursor_ = 0;
+};
+
+// `WeakValueCache` for concurrent use: keys are spread over `Shards` caches with a mutex each, the
+// sweep of an operation stays in its shard. `FindOrCreate` runs the factory without the lock, so
+// the factory may use the cache. Threads that miss a key together may each create a value, all of
+// them get the one stored first.
+template <typename K, typename T, typename Hash = std::hash<K>, typename Equal = std::equal_to<K>,
+          size_t Shards = 16>
+class ShardedWeakValueCache {
+public:
+    explicit ShardedWeakValueCache(
+        size_t purge_step = WeakValueCache<K, T, Hash, Equal>::kDefaultPurgeStep) {
+        for (Shard& shard : shards_) {
+            shard.cache = WeakValueCache<K, T, Hash, Equal>(purge_step);
+        }
+    }
+
+    SharedPtr<T> Find(const K& key) {
+        Shard& shard = ShardOf(key);
+        std::lock_guard lock(shard.mutex);
+        return shard.cache.Find(key);
+    }
+
+    template <typename Factory>
+    SharedPtr<T> FindOrCreate(const K& key, Factory&& factory) {
+        Shard& shard = ShardOf(key);
+        {
+            std::lock_guard lock(shard.mutex);
+            if (SharedPtr<T> value = shard.cache.Find(key)) {
+                return value;
+            }
+        }
+        SharedPtr<T> value = std::forward<Factory>(factory)();
+        std::lock_guard lock(shard.mutex);
+        return shard.cache.FindOrCreate(key, [&value] { return std::move(value); });
+    }
+
+    void Insert(const K& key, const SharedPtr<T>& value) {
+        Shard& shard = ShardOf(key);
+        std::lock_guard lock(shard.mutex);
+        shard.cache.Insert(key, value);
+    }
+
+    bool Erase(const K& key) {
+        Shard& shard = ShardOf(key);
+        std::lock_guard lock(shard.mutex);
+        return shard.cache.Erase(key);
+    }
+
+    void Clear() {
+        for (Shard& shard : shards_) {
+            std::lock_guard lock(shard.mutex);
+            shard.cache.Clear();
+        }
+    }
+
+    // Sweeps `buckets` buckets of every shard, one shard locked at a time
+    size_t Purge(size_t buckets) {
+        size_t erased = 0;
+        for (Shard& shard : shards_) {
+            std::lock_guard lock(shard.mutex);
+            erased += shard.cache.Purge(buckets);
+        }
+        return erased;
+    }
+
+    size_t Size() {
+        size_t size = 0;
+        for (Shard& shard : shards_) {
+            std::lock_guard lock(shard.mutex);
+            size += shard.cache.Size();
+        }
+        return size;
+    }
+
+private:
+    struct alignas(64) Shard {  // the mutexes of neighbours do not share a cache line
+        std::mutex mutex;
+        WeakValueCache<K, T, Hash, Equal> cache;
+    };
+
+    Shard& ShardOf(const K& key) {
+        // The maps of the shards take the hash modulo their bucket count, mix it before taking
+        // another modulo so that the shards do not all get the same buckets
+        uint64_t hash = static_cast<uint64_t>(hash_(key)) * 0x9E3779B97F4A7C15;
+        return shards_[(hash >> 32) % Shards];
+    }
+
+    std::array<Shard, Shards> shards_;
+    Hash hash_;
+};
@@ -2,111 +2,18 @@
 
 #include "sw_fwd.h"  // Forward declaration
 
-#include <cstddef>  // std::nullptr_t
-
-class ControlBlockBase {
-public:
-    size_t GetStrongRefCount() const {
-        return strong_ref_count_;
-    }
-    size_t GetWeakRefCount() const {
-        return weak_ref_count_;
-    }
-
-    virtual void IncStrongRef() = 0;
-
-    virtual void DecStrongRef() = 0;
-
-    virtual void IncWeakRef() = 0;
+#include <common/relocate.h>
 
-    virtual void DecWeakRef() = 0;
-
-    virtual ~ControlBlockBase() = default;
-
-protected:
-    size_t strong_ref_count_ = 0;
-    size_t weak_ref_count_ = 0;
-};
-
-template <typename Y>
-class ControlBlockPointer : public ControlBlockBase {
-public:
-    ControlBlockPointer(Y* ptr) : ptr_(ptr) {
-    }
-
-    void IncStrongRef() override {
-        ++strong_ref_count_;
-    }
-
-    void DecStrongRef() override {
-        --strong_ref_count_;
-        if (strong_ref_count_ == 0) {
-            delete ptr_;
-            ptr_ = nullptr;
-        }
-    }
-
-    void IncWeakRef() override {
-        ++weak_ref_count_;
-    }
-
-    void DecWeakRef() override {
-        --weak_ref_count_;
-    }
-
-    ~ControlBlockPointer() override {
-        if (ptr_) {
-            delete ptr_;
-        }
-    }
-
-private:
-    Y* ptr_;
-};
-
-template <typename Y>
-class ControlBlockHolder : public ControlBlockBase {
-public:
-    template <typename... Args>
-    ControlBlockHolder(Args&&... args) {
-        new (GetPointer()) Y(std::forward<Args>(args)...);
-    }
-
-    Y* GetPointer() {
-        return reinterpret_cast<Y*>(&storage_);
-    }
-
-    void IncStrongRef() {
-        ++strong_ref_count_;
-    }
-
-    void DecStrongRef() override {
-        --strong_ref_count_;
-        if (strong_ref_count_ == 0) {
-            GetPointer()->~Y();
-        }
-    }
-
-    void IncWeakRef() override {
-        ++weak_ref_count_;
-    }
-
-    void DecWeakRef() override {
-        --weak_ref_count_;
-    }
-
-    ~ControlBlockHolder() override {
-        GetPointer()->~Y();
-    }
-
-private:
-    alignas(Y) char storage_[sizeof(Y)];  // inner storage of Y
-};
+#include <cstddef>  // std::nullptr_t
+#include <memory_resource>
 
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
-template <typename T>
+// `Policy` is a counter policy from sw_fwd.h, `LocalSharedPtr` below is the single-threaded flavor
+template <typename T, typename Policy>
 class SharedPtr {
 public:
+    using element_type = std::remove_extent_t<T>;  // T may be an array, U[] or U[N]
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -116,29 +23,46 @@ public:
     }
     // default pointers are already nullptr
 
-    explicit SharedPtr(T* ptr) : ptr_(ptr), block_(new ControlBlockPointer<T>(ptr)) {
-        block_->IncStrongRef();
+    explicit SharedPtr(element_type* ptr) : ptr_(ptr), block_(new ControlBlockPointer<T>(ptr)) {
+        static_assert(!kBiased, "biased blocks come only from MakeBiasedShared");
+        block_->IncStrongRef<Policy>();
     }
 
     template <typename Up>  // require Up* to be convertible to T*
     explicit SharedPtr(Up* ptr) : ptr_(ptr), block_(new ControlBlockPointer<Up>(ptr)) {
-        block_->IncStrongRef();
+        static_assert(!kBiased, "biased blocks come only from MakeBiasedShared");
+        block_->IncStrongRef<Policy>();
+    }
+
+    // Custom deleter, e.g. for memory from `malloc` or from a pool. The block is allocated with
+    // `alloc`. If that throws, `ptr` is released with the deleter.
+    template <typename Up, typename Deleter, typename Alloc = std::allocator<Up>>
+    SharedPtr(Up* ptr, Deleter deleter, const Alloc& alloc = Alloc()) : ptr_(ptr) {
+        static_assert(!kBiased, "biased blocks come only from MakeBiasedShared");
+        using Block = ControlBlockDeleter<Up, Deleter, Alloc>;
+        try {
+            block_ = Block::Create(ptr, std::move(deleter), alloc);
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
+        block_->IncStrongRef<Policy>();
     }
 
     SharedPtr(const SharedPtr& other) : ptr_(other.ptr_), block_(other.block_) {
         if (block_) {
-            block_->IncStrongRef();
+            block_->IncStrongRef<Policy>();
         }
     }
 
     template <typename Up>
-    SharedPtr(const SharedPtr<Up>& other) : ptr_(other.ptr_), block_(other.block_) {
+    SharedPtr(const SharedPtr<Up, Policy>& other) : ptr_(other.ptr_), block_(other.block_) {
         if (block_) {
-            block_->IncStrongRef();
+            block_->IncStrongRef<Policy>();
         }
     }
 
-    SharedPtr(SharedPtr&& other) {
+    SharedPtr(SharedPtr&& other) noexcept {
         DecBlockRef();
         ptr_ = other.ptr_;
         block_ = other.block_;
@@ -148,7 +72,7 @@ public:
     }
 
     template <typename Up>
-    SharedPtr(SharedPtr<Up>&& other) {
+    SharedPtr(SharedPtr<Up, Policy>&& other) noexcept {
         DecBlockRef();
         ptr_ = other.ptr_;
         block_ = other.block_;
@@ -160,8 +84,27 @@ public:
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) : ptr_(ptr), block_(other.block_) {
-        block_->IncStrongRef();
+    SharedPtr(const SharedPtr<Y, Policy>& other, element_type* ptr)
+        : ptr_(ptr), block_(other.block_) {
+        block_->IncStrongRef<Policy>();
+    }
+
+    // Switch the counter policy, e.g. hand a `LocalSharedPtr` over to other threads. Only the sole
+    // owner may do it, otherwise the remaining owners would keep using the old policy.
+    template <typename Up, typename OtherPolicy>
+    explicit SharedPtr(SharedPtr<Up, OtherPolicy>&& other) {
+        static_assert(!kBiased && !std::is_same_v<OtherPolicy, BiasedRefCount>,
+                      "biased blocks have their own layout");
+        if (other.block_) {
+            if (!other.block_->IsUnique()) {
+                throw BadSharedPtrConversion();
+            }
+        }
+        ptr_ = other.ptr_;
+        block_ = other.block_;
+
+        other.ptr_ = nullptr;
+        other.block_ = nullptr;
     }
 
     // Promote `WeakPtr`
@@ -174,24 +117,24 @@ public:
     SharedPtr& operator=(const SharedPtr& other) {
         DecBlockRef();
         if (other.block_) {
-            other.block_->IncStrongRef();
+            other.block_->template IncStrongRef<Policy>();
         }
         ptr_ = other.ptr_;
         block_ = other.block_;
         return *this;
     }
     template <typename Up>
-    SharedPtr& operator=(const SharedPtr<Up>& other) {
+    SharedPtr& operator=(const SharedPtr<Up, Policy>& other) {
         DecBlockRef();
         if (other.block_) {
-            other.block_->IncStrongRef();
+            other.block_->template IncStrongRef<Policy>();
         }
         ptr_ = other.ptr_;
         block_ = other.block_;
         return *this;
     }
 
-    SharedPtr& operator=(SharedPtr&& other) {
+    SharedPtr& operator=(SharedPtr&& other) noexcept {
         DecBlockRef();
         ptr_ = other.ptr_;
         block_ = other.block_;
@@ -201,7 +144,7 @@ public:
         return *this;
     }
     template <typename Up>
-    SharedPtr& operator=(SharedPtr<Up>&& other) {
+    SharedPtr& operator=(SharedPtr<Up, Policy>&& other) noexcept {
         DecBlockRef();
         ptr_ = other.ptr_;
         block_ = other.block_;
@@ -231,34 +174,91 @@ public:
 
     template <typename Up>
     void Reset(Up* ptr) {  // to be precise we need to be sure that Up* is convertible to T*a
+        static_assert(!kBiased, "biased blocks come only from MakeBiasedShared");
         if (ptr == nullptr) {
             Reset();
         } else {
             DecBlockRef();
             ptr_ = ptr;
-            block_ = new ControlBlockPointer<Up>(ptr);
-            block_->IncStrongRef();
+            block_ = new ControlBlockPointer<std::conditional_t<std::is_array_v<T>, T, Up>>(ptr);
+            block_->IncStrongRef<Policy>();
         }
     }
-    void Swap(SharedPtr& other) {
+    void Swap(SharedPtr& other) noexcept {
         std::swap(ptr_, other.ptr_);
         std::swap(block_, other.block_);
     }
 
+    // Writes `count` copies to `out` with one update of the strong count instead of `count`, e.g.
+    // to fan one object out to many queues. Returns the iterator past the last copy.
+    template <typename OutputIt>
+    OutputIt CloneN(size_t count, OutputIt out) const {
+        if (block_ && count) {
+            if constexpr (kBiased) {
+                for (size_t i = 0; i < count; ++i) {
+                    block_->IncStrongRef<Policy>();
+                }
+            } else {
+                block_->template IncStrongRefs<Policy>(count);
+            }
+        }
+        size_t written = 0;
+        try {
+            for (; written < count; ++written) {
+                SharedPtr copy;  // adopts one of the references
+                copy.ptr_ = ptr_;
+                copy.block_ = block_;
+                *out = std::move(copy);
+                ++out;
+            }
+        } catch (...) {  // the copy that failed has released its reference
+            if (block_ && count - written > 1) {
+                ReleaseRefs(block_, count - written - 1);
+            }
+            throw;
+        }
+        return out;
+    }
+
+    // Resets the pointers in [first, last). Neighbours that share a block give their references
+    // back with one update, e.g. the copies from `CloneN`.
+    template <typename ForwardIt>
+    static void ReleaseAll(ForwardIt first, ForwardIt last) {
+        while (first != last) {
+            ControlBlockBase* block = first->block_;
+            size_t count = 0;
+            for (; first != last && first->block_ == block; ++first) {
+                first->ptr_ = nullptr;
+                first->block_ = nullptr;
+                ++count;
+            }
+            if (block) {
+                ReleaseRefs(block, count);
+            }
+        }
+    }
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T* Get() const {
+    element_type* Get() const {
         return ptr_;
     }
-    T& operator*() const {
+    element_type& operator*() const {
         return *ptr_;
     }
-    T* operator->() const {
+    element_type* operator->() const {
         return ptr_;
     }
+    element_type& operator[](size_t i) const {
+        static_assert(std::is_array_v<T>, "operator[] is only for arrays");
+        return ptr_[i];
+    }
     size_t UseCount() const {
         if (block_) {
+            if constexpr (kBiased) {
+                return BiasedRefCount::UseCount(block_);
+            }
             return block_->GetStrongRefCount();
         }
         return 0;
@@ -271,49 +271,180 @@ public:
     }
 
 private:
-    T* ptr_ = nullptr;
+    static constexpr bool kBiased = std::is_same_v<Policy, BiasedRefCount>;
+
+    element_type* ptr_ = nullptr;
     ControlBlockBase* block_ = nullptr;
 
     void DecBlockRef() {
         if (block_) {
-            block_->DecStrongRef();
+            if (block_->ReleaseStrongRef<Policy>()) {  // we held the last reference of any kind
+                block_->DeallocateBlock();
+            }
+            block_ = nullptr;
         }
-        if (block_) {
-            if (block_->GetStrongRefCount() == 0 &&
-                block_->GetWeakRefCount() == 0) {  // may be "delete nullptr"
-                delete block_;
-                block_ = nullptr;
+    }
+
+    static void ReleaseRefs(ControlBlockBase* block, size_t count) {
+        if constexpr (kBiased) {
+            for (size_t i = 0; i < count; ++i) {
+                if (block->ReleaseStrongRef<Policy>()) {
+                    block->DeallocateBlock();
+                }
             }
+        } else if (block->DecStrongRefs<Policy>(count)) {
+            block->DeallocateBlock();
         }
     }
 
-    template <typename Y>
+    template <typename Y, typename OtherPolicy>
     friend class SharedPtr;  // Now SharedPtr<Y> is a friend of SharedPtr
 
     template <typename Y>
     friend class WeakPtr;  // for ctor from weak ptr, which is not realized here
 
+    friend class CycleTracer;
+
     template <typename P, typename... Args>
     friend SharedPtr<P> MakeShared(Args&&... args);
+
+    template <typename P, typename... Args>
+    friend SharedPtr<P> MakeSharedForOverwrite(Args&&... args);
+
+    template <typename P, typename... Args>
+    friend SharedPtr<P, LocalRefCount> MakeLocalShared(Args&&... args);
+
+    template <typename P, typename... Args>
+    friend SharedPtr<P, BiasedRefCount> MakeBiasedShared(Args&&... args);
+
+    template <typename P, typename Alloc, typename... Args>
+    friend SharedPtr<P> AllocateShared(const Alloc& alloc, Args&&... args);
 };
 
+template <typename T>
+using LocalSharedPtr = SharedPtr<T, LocalRefCount>;
+
+template <typename T>
+using BiasedSharedPtr = SharedPtr<T, BiasedRefCount>;
+
+// The counters are in the block, see common/relocate.h
+template <typename T, typename Policy>
+inline constexpr bool kTriviallyRelocatable<SharedPtr<T, Policy>> = true;
+
 // template <typename T, typename U>
 // inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
 //
 // }
 
+template <typename Element>
+ControlBlockArrayHolder<Element>* CreateArrayBlock(size_t size) {
+    return ControlBlockArrayHolder<Element>::Create(size, [](Element* place) {
+        new (place) Element();
+    });
+}
+
+template <typename Element>
+ControlBlockArrayHolder<Element>* CreateArrayBlock(size_t size, const Element& value) {
+    return ControlBlockArrayHolder<Element>::Create(size, [&value](Element* place) {
+        new (place) Element(value);
+    });
+}
+
 // Allocate memory only once
+// Arrays: `MakeShared<T[]>(size)` or `MakeShared<T[N]>()`, optionally followed by the value to copy
+// into every element
 template <typename T, typename... Args>
 SharedPtr<T> MakeShared(Args&&... args) {
     SharedPtr<T> s;
+    if constexpr (std::is_unbounded_array_v<T>) {
+        auto block = CreateArrayBlock<std::remove_extent_t<T>>(std::forward<Args>(args)...);
+        s.ptr_ = block->GetPointer();
+        s.block_ = block;
+    } else if constexpr (std::is_bounded_array_v<T>) {
+        auto block = CreateArrayBlock<std::remove_extent_t<T>>(std::extent_v<T>,
+                                                              std::forward<Args>(args)...);
+        s.ptr_ = block->GetPointer();
+        s.block_ = block;
+    } else {
+        ControlBlockHolder<T>* block = new ControlBlockHolder<T>(std::forward<Args>(args)...);
+        // to have ->GetPointer() func we need to do =
+        s.ptr_ = block->GetPointer();
+        s.block_ = block;
+    }
+    s.block_->IncStrongRef();
+    return s;
+};
+
+// Same as `MakeShared`, but the object or the array elements are default-initialized, so large
+// numeric buffers are not zeroed just to be overwritten. Takes the size for `T[]`.
+template <typename T, typename... Args>
+SharedPtr<T> MakeSharedForOverwrite(Args&&... args) {
+    SharedPtr<T> s;
+    if constexpr (std::is_array_v<T>) {
+        using Element = std::remove_extent_t<T>;
+        static_assert(sizeof...(Args) == std::is_unbounded_array_v<T>, "pass only the size of T[]");
+        size_t size = std::extent_v<T>;
+        if constexpr (std::is_unbounded_array_v<T>) {
+            size = (static_cast<size_t>(args), ...);
+        }
+        auto block = ControlBlockArrayHolder<Element>::Create(size, [](Element* place) {
+            new (place) Element;
+        });
+        s.ptr_ = block->GetPointer();
+        s.block_ = block;
+    } else {
+        static_assert(sizeof...(Args) == 0, "the object is not constructed from arguments");
+        ControlBlockHolder<T>* block = new ControlBlockHolder<T>(ForOverwriteTag());
+        s.ptr_ = block->GetPointer();
+        s.block_ = block;
+    }
+    s.block_->IncStrongRef();
+    return s;
+}
+
+// Same as `MakeShared`, but the result uses non-atomic counters
+template <typename T, typename... Args>
+LocalSharedPtr<T> MakeLocalShared(Args&&... args) {
+    LocalSharedPtr<T> s;
     ControlBlockHolder<T>* block = new ControlBlockHolder<T>(std::forward<Args>(args)...);
     // to have ->GetPointer() func we need to do =
     s.ptr_ = block->GetPointer();
     s.block_ = block;
-    s.block_->IncStrongRef();
+    s.block_->template IncStrongRef<LocalRefCount>();
     return s;
 };
 
+// Same as `MakeShared`, but copies and releases on the calling thread do not use atomic RMWs,
+// see `BiasedRefCount`. Also merges the blocks other threads queued for this thread.
+template <typename T, typename... Args>
+BiasedSharedPtr<T> MakeBiasedShared(Args&&... args) {
+    BiasedRefCount::MergeQueued();
+    BiasedSharedPtr<T> s;
+    auto block = new ControlBlockBiasedHolder<T>(std::forward<Args>(args)...);
+    s.ptr_ = block->GetPointer();
+    s.block_ = block;
+    s.block_->template IncStrongRef<BiasedRefCount>();
+    return s;
+}
+
+// Same as `MakeShared`, but the block is allocated and freed by `alloc`
+template <typename T, typename Alloc, typename... Args>
+SharedPtr<T> AllocateShared(const Alloc& alloc, Args&&... args) {
+    SharedPtr<T> s;
+    auto block = ControlBlockAllocHolder<T, Alloc>::Create(alloc, std::forward<Args>(args)...);
+    s.ptr_ = block->GetPointer();
+    s.block_ = block;
+    s.block_->IncStrongRef();
+    return s;
+}
+
+// E.g. request-scoped objects from a `std::pmr::monotonic_buffer_resource`
+template <typename T, typename... Args>
+SharedPtr<T> MakeSharedPmr(std::pmr::memory_resource* resource, Args&&... args) {
+    return AllocateShared<T>(std::pmr::polymorphic_allocator<T>(resource),
+                             std::forward<Args>(args)...);
+}
+
 // Look for usage examples in tests
 // template <typename T>
 // class EnableSharedFromThis {
@@ -1,11 +1,999 @@
 #pragma once
 
+#include <common/block_pool.h>
+#include <common/block_registry.h>
+#include <common/cycle_collector.h>
+#include <common/telemetry.h>
+#include <unique/compressed_pair.h>
+
+#include <atomic>
 #include <exception>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>  // std::allocator_traits
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 class BadWeakPtr : public std::exception {};
 
-template <typename T>
+// Thrown when a pointer is moved to another counter policy while its block still has other owners
+class BadSharedPtrConversion : public std::exception {};
+
+// Thrown instead of letting a 32-bit reference count wrap around
+class RefCountOverflow : public std::exception {};
+
+// Counter policies, they decide how `SharedPtr` updates the counters of its control block.
+// Both work with the same block layout, so a uniquely owned block may change its policy.
+
+// The strong and the weak count share one 64-bit word, see `ControlBlockBase`. Policies add and
+// subtract deltas that may touch both halves at once.
+
+// Thread-safe: relaxed increments, acquire/release decrements
+struct AtomicRefCount {
+    // Returns the old value
+    static uint64_t Add(std::atomic<uint64_t>& counts, uint64_t delta) {
+        return counts.fetch_add(delta, std::memory_order_relaxed);
+    }
+    // Returns the new value
+    static uint64_t Sub(std::atomic<uint64_t>& counts, uint64_t delta) {
+        return counts.fetch_sub(delta, std::memory_order_acq_rel) - delta;
+    }
+    // Adds `delta` only if some bit of `mask` is set, returns the old value
+    static uint64_t AddIfAny(std::atomic<uint64_t>& counts, uint64_t delta, uint64_t mask) {
+        uint64_t value = counts.load(std::memory_order_relaxed);
+        while (value & mask) {
+            if (counts.compare_exchange_weak(value, value + delta, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        return value;
+    }
+};
+
+// Single-threaded: plain loads and stores, no locked RMW on the copy/destroy path.
+// Every owner of the block has to live on the same thread.
+struct LocalRefCount {
+    static uint64_t Add(std::atomic<uint64_t>& counts, uint64_t delta) {
+        uint64_t value = counts.load(std::memory_order_relaxed);
+        counts.store(value + delta, std::memory_order_relaxed);
+        return value;
+    }
+    static uint64_t Sub(std::atomic<uint64_t>& counts, uint64_t delta) {
+        uint64_t value = counts.load(std::memory_order_relaxed) - delta;
+        counts.store(value, std::memory_order_relaxed);
+        return value;
+    }
+    static uint64_t AddIfAny(std::atomic<uint64_t>& counts, uint64_t delta, uint64_t mask) {
+        uint64_t value = counts.load(std::memory_order_relaxed);
+        if (value & mask) {
+            counts.store(value + delta, std::memory_order_relaxed);
+        }
+        return value;
+    }
+};
+
+class ControlBlockBase;
+class ControlBlockBiasedBase;
+
+// Biased reference counting (Choi et al., PACT'18) for objects that are mostly copied and destroyed
+// on the thread that created them: that thread counts without RMWs. Works only with blocks from
+// `MakeBiasedShared`, so unlike the policies above it cannot be switched. Blocks released by other
+// threads below their share are queued for the owner, which merges them on its next
+// `MakeBiasedShared`, on `MergeQueued` or when it exits.
+struct BiasedRefCount {
+    static void IncStrongRef(ControlBlockBase* block);
+    static bool ReleaseStrongRef(ControlBlockBase* block);  // true if the block has to be deleted
+    static size_t UseCount(const ControlBlockBase* block);
+
+    // Merges the blocks other threads queued for the calling thread
+    static void MergeQueued();
+
+    struct Thread;
+
+private:
+    static void Queue(ControlBlockBiasedBase* block);
+    static void MergeQueuedBlock(ControlBlockBiasedBase* block, uint64_t owner);
+    static bool DestroyObject(ControlBlockBase* block);
+};
+
+// Selects default-initialization in `MakeSharedForOverwrite`
+struct ForOverwriteTag {};
+
+template <typename T, typename Policy = AtomicRefCount>
 class SharedPtr;
 
 template <typename T>
 class WeakPtr;
+
+#ifdef SMART_POINTERS_CYCLE_COLLECTOR
+// Passed to `TraceRefs` of the objects taking part in cycle collection, see
+// common/cycle_collector.h
+class CycleTracer {
+public:
+    explicit CycleTracer(std::vector<ControlBlockBase*>& children) : children_(children) {
+    }
+
+    template <typename U, typename Policy>
+    void operator()(const SharedPtr<U, Policy>& ptr) {
+        if (ptr.block_) {
+            children_.push_back(ptr.block_);
+        }
+    }
+
+private:
+    std::vector<ControlBlockBase*>& children_;
+};
+#endif
+
+// Both counts live in one 64-bit word, the weak one in the high half, so a release sees both counts
+// in the value it returns.
+class ControlBlockBase {
+public:
+    size_t GetStrongRefCount() const {
+        return counts_.load(std::memory_order_relaxed) & kStrongMask;
+    }
+    size_t GetWeakRefCount() const {
+        return counts_.load(std::memory_order_relaxed) >> kWeakShift;
+    }
+
+    // True if the caller holds the only reference of any kind
+    bool IsUnique() const {
+        return counts_.load(std::memory_order_acquire) == kStrongOne + kWeakOne;
+    }
+
+    // All strong references together hold one weak reference, which the last of them drops after
+    // destroying the object (as in libstdc++). A release that is not the last is one decrement.
+    // The block is freed by whoever drops the last reference of any kind.
+
+    template <typename Policy = AtomicRefCount>
+    void IncStrongRef() {
+#ifdef SMART_POINTERS_TELEMETRY
+        telemetry::OnStrongIncrement(*vtable_->type);
+#endif
+        if constexpr (std::is_same_v<Policy, BiasedRefCount>) {
+            BiasedRefCount::IncStrongRef(this);
+        } else {
+            Add<Policy>(kStrongOne);
+        }
+    }
+
+    // Used to promote `WeakPtr`, never revives an object whose strong count already hit zero
+    template <typename Policy = AtomicRefCount>
+    bool IncStrongRefIfNotZero() {
+        uint64_t old = Policy::AddIfAny(counts_, kStrongOne, kStrongMask);
+        if (!(old & kStrongMask)) {
+            return false;
+        }
+        CheckOverflow<Policy>(old, kStrongOne);
+#ifdef SMART_POINTERS_TELEMETRY
+        telemetry::OnStrongIncrement(*vtable_->type);
+#endif
+        return true;
+    }
+
+    // Same for `WeakPtr::TryLock`, but fails instead of throwing when the count is at its limit.
+    // One CAS loop that checks the value it replaces: a strong count seen as zero is never
+    // incremented, however the race with the last release goes.
+    bool TryIncStrongRef() noexcept {
+        uint64_t value = counts_.load(std::memory_order_relaxed);
+        do {
+            uint64_t strong = value & kStrongMask;
+            if (strong == 0 || strong == kMaxCount) {
+                return false;
+            }
+        } while (!counts_.compare_exchange_weak(value, value + kStrongOne,
+                                                std::memory_order_relaxed));
+#ifdef SMART_POINTERS_TELEMETRY
+        telemetry::OnStrongIncrement(*vtable_->type);
+#endif
+        return true;
+    }
+
+    template <typename Policy = AtomicRefCount>
+    void IncWeakRef() {
+#ifdef SMART_POINTERS_TELEMETRY
+        telemetry::OnWeakIncrement(*vtable_->type);
+#endif
+        Add<Policy>(kWeakOne);
+    }
+
+    // Returns true if that was the last reference and the block has to be deleted
+    template <typename Policy = AtomicRefCount>
+    bool DecWeakRef() {
+        return Policy::Sub(counts_, kWeakOne) == 0;  // strong == 0 && weak == 0
+    }
+
+    // Drops a strong reference, same return value as `DecWeakRef`. The sole owner without weak
+    // references sees that in one load and skips both RMWs, nobody can take a new reference then.
+    template <typename Policy = AtomicRefCount>
+    bool ReleaseStrongRef() {
+        if constexpr (std::is_same_v<Policy, BiasedRefCount>) {
+            return BiasedRefCount::ReleaseStrongRef(this);
+        } else {
+            if (counts_.load(std::memory_order_acquire) == kStrongOne + kWeakOne) {
+                DestroyObject();
+                return true;
+            }
+#ifdef SMART_POINTERS_CYCLE_COLLECTOR
+            if (vtable_->trace) {
+                return ReleaseTracedStrongRefs<Policy>(1);
+            }
+#endif
+            if ((Policy::Sub(counts_, kStrongOne) & kStrongMask) != 0) {
+                return false;
+            }
+            DestroyObject();
+            return DecWeakRef<Policy>();
+        }
+    }
+
+    // Batch versions for owners that hand references out in bulk, e.g. `AtomicSharedPtr` and
+    // `SharedPtr::CloneN`: one RMW for `count` references. Not for `BiasedRefCount`.
+    // `DecStrongRefs` returns true if the block has to be deleted.
+
+    template <typename Policy = AtomicRefCount>
+    void IncStrongRefs(size_t count) {
+        if (count > kMaxCount) {  // would spill into the weak half
+            throw RefCountOverflow();
+        }
+#ifdef SMART_POINTERS_TELEMETRY
+        telemetry::OnStrongIncrement(*vtable_->type, count);
+#endif
+        Add<Policy>(count * kStrongOne);
+    }
+
+    template <typename Policy = AtomicRefCount>
+    bool DecStrongRefs(size_t count) {
+#ifdef SMART_POINTERS_CYCLE_COLLECTOR
+        if (vtable_->trace) {
+            return ReleaseTracedStrongRefs<Policy>(count);
+        }
+#endif
+        if ((Policy::Sub(counts_, count * kStrongOne) & kStrongMask) != 0) {
+            return false;
+        }
+        DestroyObject();
+        return DecWeakRef<Policy>();
+    }
+
+    // Runs the destructor of the block and frees its memory
+    void DeallocateBlock() {
+        vtable_->deallocate_block(this);
+    }
+
+#ifdef SMART_POINTERS_POOLED_BLOCKS
+    // Blocks created with plain `new` come from `BlockPool`. Blocks are always deleted through
+    // their own type, so the sized `delete` gets the right size class.
+    static void* operator new(size_t size) {
+        return BlockPool::Allocate(size);
+    }
+    static void* operator new(size_t size, std::align_val_t align) {
+        return ::operator new(size, align);
+    }
+    static void* operator new(size_t, void* place) {
+        return place;
+    }
+    static void operator delete(void* ptr, size_t size) {
+        BlockPool::Deallocate(ptr, size);
+    }
+    static void operator delete(void* ptr, size_t size, std::align_val_t align) {
+        ::operator delete(ptr, size, align);
+    }
+    static void operator delete(void*, void*) {
+    }
+#endif
+
+protected:
+    // Manual vtable: counting is the same for every block, only these two steps differ
+    struct VTable {
+        void (*destroy_object)(ControlBlockBase*);  // when the strong count drops to zero
+        void (*deallocate_block)(ControlBlockBase*);
+#ifdef SMART_POINTERS_TELEMETRY
+        telemetry::TypeRecord* type = nullptr;
+#endif
+#ifdef SMART_POINTERS_BLOCK_REGISTRY
+        const block_registry::TypeInfo* block_type = nullptr;
+#endif
+#ifdef SMART_POINTERS_CYCLE_COLLECTOR
+        // Appends the blocks the object holds strong references to, null if it is not traced
+        void (*trace)(ControlBlockBase*, std::vector<ControlBlockBase*>&) = nullptr;
+#endif
+    };
+
+    // The vtable of a block that holds or points to a `Y`. `Block::GetPointer` is used to reach
+    // the object for cycle collection, blocks without it leave `Block` void.
+    template <typename Y, typename Block = void>
+    static constexpr VTable MakeVTable(void (*destroy_object)(ControlBlockBase*),
+                                       void (*deallocate_block)(ControlBlockBase*)) {
+        VTable vtable{destroy_object, deallocate_block};
+#ifdef SMART_POINTERS_TELEMETRY
+        vtable.type = &telemetry::kTypeRecord<Y>;
+#endif
+#ifdef SMART_POINTERS_BLOCK_REGISTRY
+        vtable.block_type = &block_registry::kTypeInfo<Y>;
+#endif
+#ifdef SMART_POINTERS_CYCLE_COLLECTOR
+        constexpr bool traced = requires(const Y& object, CycleTracer& tracer) {
+            object.TraceRefs(tracer);
+        };
+        if constexpr (!std::is_void_v<Block> && traced) {
+            vtable.trace = &TraceObject<Y, Block>;
+        }
+#endif
+        return vtable;
+    }
+
+    explicit ControlBlockBase(const VTable* vtable) : vtable_(vtable) {
+#ifdef SMART_POINTERS_TELEMETRY
+        born_ = telemetry::Now();
+        telemetry::OnCreate(*vtable_->type);
+#endif
+#ifdef SMART_POINTERS_BLOCK_REGISTRY
+        registry_node_.block = this;
+        registry_node_.info = vtable_->block_type;
+        registry_node_.read_counts = &ReadCounts;
+        block_registry::Registry::Get().Add(&registry_node_);
+#endif
+    }
+
+#if defined(SMART_POINTERS_TELEMETRY) || defined(SMART_POINTERS_BLOCK_REGISTRY)
+    ~ControlBlockBase() {
+#ifdef SMART_POINTERS_TELEMETRY
+        if (born_ != kDestroyed) {
+            telemetry::OnAbandon(*vtable_->type);
+        }
+#endif
+#ifdef SMART_POINTERS_BLOCK_REGISTRY
+        block_registry::Registry::Get().Remove(&registry_node_);
+#endif
+    }
+#else
+    ~ControlBlockBase() = default;  // not virtual, use `DeallocateBlock`
+#endif
+
+private:
+    friend struct BiasedRefCount;
+#ifdef SMART_POINTERS_CYCLE_COLLECTOR
+    template <typename Block>
+    friend class cycle_collector::Collector;
+#endif
+
+    void DestroyObject() {
+#ifdef SMART_POINTERS_TELEMETRY
+        telemetry::OnDestroy(*vtable_->type, born_);
+        born_ = kDestroyed;
+#endif
+        vtable_->destroy_object(this);
+    }
+
+    static constexpr int kWeakShift = 32;
+    static constexpr uint64_t kStrongOne = 1;
+    static constexpr uint64_t kWeakOne = uint64_t(1) << kWeakShift;
+    static constexpr uint64_t kStrongMask = kWeakOne - 1;
+    // Way below 2^32, so that concurrent increments past the check cannot wrap either half
+    static constexpr uint64_t kMaxCount = (uint64_t(1) << 31) - 1;
+
+    template <typename Policy>
+    void Add(uint64_t delta) {
+        CheckOverflow<Policy>(Policy::Add(counts_, delta), delta);
+    }
+
+    // `old` is the value before adding `delta`, which is taken back if either count got too large
+    template <typename Policy>
+    void CheckOverflow(uint64_t old, uint64_t delta) {
+        uint64_t counts = old + delta;
+        if ((counts & kStrongMask) > kMaxCount || (counts >> kWeakShift) > kMaxCount) {
+            Policy::Sub(counts_, delta);
+            throw RefCountOverflow();
+        }
+    }
+
+    const VTable* vtable_;
+    std::atomic<uint64_t> counts_ = kWeakOne;  // the weak reference of the strong ones
+#ifdef SMART_POINTERS_TELEMETRY
+    static constexpr uint64_t kDestroyed = ~uint64_t(0);
+    uint64_t born_;  // `telemetry::Now()` at creation, `kDestroyed` once the object is gone
+#endif
+#ifdef SMART_POINTERS_BLOCK_REGISTRY
+    // Weak references without the one of the strong ones
+    static void ReadCounts(const void* block, size_t& strong, size_t& weak) {
+        auto base = static_cast<const ControlBlockBase*>(block);
+        strong = base->GetStrongRefCount();
+        weak = base->GetWeakRefCount() - (strong != 0);
+    }
+
+    block_registry::Node registry_node_;
+#endif
+#ifdef SMART_POINTERS_CYCLE_COLLECTOR
+    // Turns the released strong references into a weak one in the same RMW. The collector takes
+    // it over if the object lives on, so the block stays allocated while it is a candidate.
+    template <typename Policy>
+    bool ReleaseTracedStrongRefs(size_t count) {
+        if ((Policy::Sub(counts_, count * kStrongOne - kWeakOne) & kStrongMask) != 0) {
+            cycle_collector::Collector<ControlBlockBase>::Get().AddCandidate(this);
+            return false;
+        }
+        DestroyObject();
+        return Policy::Sub(counts_, 2 * kWeakOne) == 0;
+    }
+
+    // The collector destroyed the object while holding one strong reference, drops it along with
+    // the weak reference of the strong ones
+    bool ReleaseDestroyed() {
+        return AtomicRefCount::Sub(counts_, kStrongOne + kWeakOne) == 0;
+    }
+
+    static bool IsTraced(const ControlBlockBase* block) {
+        return block->vtable_->trace;
+    }
+
+    static void TraceChildren(ControlBlockBase* block, std::vector<ControlBlockBase*>& children) {
+        block->vtable_->trace(block, children);
+    }
+
+    template <typename Y, typename Block>
+    static void TraceObject(ControlBlockBase* block, std::vector<ControlBlockBase*>& children) {
+        CycleTracer tracer(children);
+        std::as_const(*static_cast<Block*>(block)->GetPointer()).TraceRefs(tracer);
+    }
+#endif
+};
+
+#ifdef SMART_POINTERS_CYCLE_COLLECTOR
+using CycleCollector = cycle_collector::Collector<ControlBlockBase>;
+
+// Destroys the garbage cycles reachable from the candidates buffered so far
+inline cycle_collector::Stats CollectCycles() {
+    return CycleCollector::Get().Collect();
+}
+#endif
+
+// `Y` may be an array type, then the pointer is released with `delete[]`
+template <typename Y>
+class ControlBlockPointer : public ControlBlockBase {
+public:
+    ControlBlockPointer(std::remove_extent_t<Y>* ptr) : ControlBlockBase(&kVTable), ptr_(ptr) {
+    }
+
+    ~ControlBlockPointer() {
+        if (ptr_) {
+            Delete(ptr_);
+        }
+    }
+
+    std::remove_extent_t<Y>* GetPointer() {
+        return ptr_;
+    }
+
+private:
+    static void Delete(std::remove_extent_t<Y>* ptr) {
+        if constexpr (std::is_array_v<Y>) {
+            delete[] ptr;
+        } else {
+            delete ptr;
+        }
+    }
+
+    static void DestroyObject(ControlBlockBase* base) {
+        auto block = static_cast<ControlBlockPointer*>(base);
+        Delete(block->ptr_);
+        block->ptr_ = nullptr;
+    }
+
+    static void DeallocateBlock(ControlBlockBase* base) {
+        delete static_cast<ControlBlockPointer*>(base);
+    }
+
+    static constexpr VTable kVTable =
+        MakeVTable<Y, ControlBlockPointer>(&DestroyObject, &DeallocateBlock);
+
+    std::remove_extent_t<Y>* ptr_;
+};
+
+// Releases the pointer with a custom deleter and lives in memory from `Alloc`. Both are kept in
+// `CompressedPair`s, so stateless deleters and allocators add no bytes to the block.
+template <typename Y, typename Deleter, typename Alloc>
+class ControlBlockDeleter : public ControlBlockBase {
+    using BlockAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockDeleter>;
+    using BlockTraits = std::allocator_traits<BlockAlloc>;
+
+public:
+    // Does not release `ptr` if the allocation throws, that is up to the caller
+    static ControlBlockDeleter* Create(Y* ptr, Deleter&& deleter, const Alloc& alloc) {
+        BlockAlloc block_alloc(alloc);
+        ControlBlockDeleter* block = BlockTraits::allocate(block_alloc, 1);
+        new (block) ControlBlockDeleter(ptr, std::move(deleter), block_alloc);
+        return block;
+    }
+
+private:
+    ControlBlockDeleter(Y* ptr, Deleter&& deleter, const BlockAlloc& alloc)
+        : ControlBlockBase(&kVTable),
+          data_(CompressedPair<Y*, Deleter>(ptr, std::move(deleter)), alloc) {
+    }
+
+    static void DestroyObject(ControlBlockBase* base) {
+        auto& ptr_and_deleter = static_cast<ControlBlockDeleter*>(base)->data_.GetFirst();
+        ptr_and_deleter.GetSecond()(ptr_and_deleter.GetFirst());
+    }
+
+    static void DeallocateBlock(ControlBlockBase* base) {
+        auto block = static_cast<ControlBlockDeleter*>(base);
+        BlockAlloc block_alloc(std::move(block->data_.GetSecond()));
+        block->~ControlBlockDeleter();
+        BlockTraits::deallocate(block_alloc, block, 1);
+    }
+
+    static constexpr VTable kVTable = MakeVTable<Y>(&DestroyObject, &DeallocateBlock);
+
+    CompressedPair<CompressedPair<Y*, Deleter>, BlockAlloc> data_;
+};
+
+#ifndef SMART_POINTERS_SEPARATE_STORAGE_THRESHOLD
+#define SMART_POINTERS_SEPARATE_STORAGE_THRESHOLD 1024
+#endif
+
+// Objects this large made by `MakeShared` get an allocation of their own, freed as soon as the
+// strong count drops to zero, so that weak references pin only the small block. Specialize for a
+// type to choose per type.
+template <typename Y>
+inline constexpr bool kSeparateObjectStorage =
+    sizeof(Y) >= SMART_POINTERS_SEPARATE_STORAGE_THRESHOLD;
+
+template <typename Y, bool Separate = kSeparateObjectStorage<Y>>
+class ControlBlockHolder : public ControlBlockBase {
+public:
+    template <typename... Args>
+    ControlBlockHolder(Args&&... args) : ControlBlockBase(&kVTable) {
+        new (GetPointer()) Y(std::forward<Args>(args)...);
+    }
+
+    explicit ControlBlockHolder(ForOverwriteTag) : ControlBlockBase(&kVTable) {
+        new (GetPointer()) Y;  // default-initialized
+    }
+
+    Y* GetPointer() {
+        return reinterpret_cast<Y*>(&storage_);
+    }
+
+    ~ControlBlockHolder() = default;
+
+private:
+    static void DestroyObject(ControlBlockBase* base) {
+        static_cast<ControlBlockHolder*>(base)->GetPointer()->~Y();
+    }
+
+    static void DeallocateBlock(ControlBlockBase* base) {
+        delete static_cast<ControlBlockHolder*>(base);
+    }
+
+    static constexpr VTable kVTable =
+        MakeVTable<Y, ControlBlockHolder>(&DestroyObject, &DeallocateBlock);
+
+    alignas(Y) char storage_[sizeof(Y)];  // inner storage of Y
+};
+
+template <typename Y>
+class ControlBlockHolder<Y, true> : public ControlBlockBase {
+public:
+    template <typename... Args>
+    ControlBlockHolder(Args&&... args) : ControlBlockBase(&kVTable), ptr_(Allocate()) {
+        try {
+            new (ptr_) Y(std::forward<Args>(args)...);
+        } catch (...) {
+            Deallocate(ptr_);
+            throw;
+        }
+    }
+
+    explicit ControlBlockHolder(ForOverwriteTag) : ControlBlockBase(&kVTable), ptr_(Allocate()) {
+        try {
+            new (ptr_) Y;  // default-initialized
+        } catch (...) {
+            Deallocate(ptr_);
+            throw;
+        }
+    }
+
+    Y* GetPointer() {
+        return ptr_;
+    }
+
+    ~ControlBlockHolder() = default;
+
+private:
+    static Y* Allocate() {
+        return std::allocator<Y>().allocate(1);
+    }
+
+    static void Deallocate(Y* ptr) {
+        std::allocator<Y>().deallocate(ptr, 1);
+    }
+
+    static void DestroyObject(ControlBlockBase* base) {
+        Y* ptr = static_cast<ControlBlockHolder*>(base)->ptr_;
+        ptr->~Y();
+        Deallocate(ptr);
+    }
+
+    static void DeallocateBlock(ControlBlockBase* base) {
+        delete static_cast<ControlBlockHolder*>(base);
+    }
+
+    static constexpr VTable kVTable =
+        MakeVTable<Y, ControlBlockHolder>(&DestroyObject, &DeallocateBlock);
+
+    Y* ptr_;
+};
+
+// Elements of `Y[]` live in the same allocation, right after the block
+template <typename Y>
+class ControlBlockArrayHolder : public ControlBlockBase {
+    static_assert(!std::is_array_v<Y>, "arrays of arrays are not supported");
+
+public:
+    // `construct(place)` creates one element, called for every element in order
+    template <typename Construct>
+    static ControlBlockArrayHolder* Create(size_t size, Construct construct) {
+        if (size > (std::numeric_limits<size_t>::max() - ElementsOffset()) / sizeof(Y)) {
+            throw std::bad_array_new_length();
+        }
+        void* memory = Allocate(ElementsOffset() + size * sizeof(Y));
+        auto block = new (memory) ControlBlockArrayHolder(size);
+        size_t constructed = 0;
+        try {
+            for (; constructed < size; ++constructed) {
+                construct(block->GetPointer() + constructed);
+            }
+        } catch (...) {
+            block->DestroyElements(constructed);
+            block->~ControlBlockArrayHolder();
+            Deallocate(memory);
+            throw;
+        }
+        return block;
+    }
+
+    Y* GetPointer() {
+        return reinterpret_cast<Y*>(reinterpret_cast<char*>(this) + ElementsOffset());
+    }
+
+private:
+    explicit ControlBlockArrayHolder(size_t size) : ControlBlockBase(&kVTable), size_(size) {
+    }
+
+    static constexpr size_t ElementsOffset() {
+        return (sizeof(ControlBlockArrayHolder) + alignof(Y) - 1) / alignof(Y) * alignof(Y);
+    }
+
+    static void* Allocate(size_t bytes) {
+        if constexpr (alignof(Y) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            return ::operator new(bytes, std::align_val_t(alignof(Y)));
+        } else {
+            return ::operator new(bytes);
+        }
+    }
+
+    static void Deallocate(void* memory) {
+        if constexpr (alignof(Y) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ::operator delete(memory, std::align_val_t(alignof(Y)));
+        } else {
+            ::operator delete(memory);
+        }
+    }
+
+    void DestroyElements(size_t count) {  // in reverse order of construction
+        while (count > 0) {
+            GetPointer()[--count].~Y();
+        }
+    }
+
+    static void DestroyObject(ControlBlockBase* base) {
+        auto block = static_cast<ControlBlockArrayHolder*>(base);
+        block->DestroyElements(block->size_);
+    }
+
+    static void DeallocateBlock(ControlBlockBase* base) {
+        auto block = static_cast<ControlBlockArrayHolder*>(base);
+        block->~ControlBlockArrayHolder();
+        Deallocate(block);
+    }
+
+    static constexpr VTable kVTable = MakeVTable<Y>(&DestroyObject, &DeallocateBlock);
+
+    size_t size_;
+};
+
+// Same as `ControlBlockHolder`, but the block lives in memory from `Alloc`. The allocator is
+// rebound to the block type and shares space with the object, so stateless ones take no room.
+template <typename Y, typename Alloc>
+class ControlBlockAllocHolder : public ControlBlockBase {
+    using BlockAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockAllocHolder>;
+    using BlockTraits = std::allocator_traits<BlockAlloc>;
+    using ObjectAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Y>;
+    using ObjectTraits = std::allocator_traits<ObjectAlloc>;
+
+public:
+    template <typename... Args>
+    static ControlBlockAllocHolder* Create(const Alloc& alloc, Args&&... args) {
+        BlockAlloc block_alloc(alloc);
+        ControlBlockAllocHolder* block = BlockTraits::allocate(block_alloc, 1);
+        try {
+            new (block) ControlBlockAllocHolder(block_alloc, std::forward<Args>(args)...);
+        } catch (...) {
+            BlockTraits::deallocate(block_alloc, block, 1);
+            throw;
+        }
+        return block;
+    }
+
+    Y* GetPointer() {
+        return reinterpret_cast<Y*>(&data_.GetSecond().storage);
+    }
+
+private:
+    struct Storage {
+        Storage() {  // leave the memory uninitialized
+        }
+
+        alignas(Y) char storage[sizeof(Y)];
+    };
+
+    template <typename... Args>
+    ControlBlockAllocHolder(const BlockAlloc& alloc, Args&&... args)
+        : ControlBlockBase(&kVTable), data_(alloc) {
+        ObjectAlloc object_alloc(data_.GetFirst());
+        ObjectTraits::construct(object_alloc, GetPointer(), std::forward<Args>(args)...);
+    }
+
+    static void DestroyObject(ControlBlockBase* base) {
+        auto block = static_cast<ControlBlockAllocHolder*>(base);
+        ObjectAlloc object_alloc(block->data_.GetFirst());
+        ObjectTraits::destroy(object_alloc, block->GetPointer());
+    }
+
+    static void DeallocateBlock(ControlBlockBase* base) {
+        auto block = static_cast<ControlBlockAllocHolder*>(base);
+        BlockAlloc block_alloc(std::move(block->data_.GetFirst()));
+        block->~ControlBlockAllocHolder();
+        BlockTraits::deallocate(block_alloc, block, 1);
+    }
+
+    static constexpr VTable kVTable =
+        MakeVTable<Y, ControlBlockAllocHolder>(&DestroyObject, &DeallocateBlock);
+
+    CompressedPair<BlockAlloc, Storage> data_;
+};
+
+// Threads that own biased blocks, other threads queue blocks for them under `Mutex()`
+struct BiasedRefCount::Thread {
+    Thread() : id(NextId()) {
+        CurrentId() = id;
+        std::lock_guard lock(Mutex());
+        Registry()[id] = this;
+    }
+
+    // Later releases on this thread go to the shared count, so nobody touches `biased_` of the
+    // blocks this thread owned and whoever queues one of them merges it at once
+    ~Thread() {
+        CurrentId() = 0;
+        std::vector<ControlBlockBiasedBase*> blocks;
+        {
+            std::lock_guard lock(Mutex());
+            Registry().erase(id);
+            blocks.swap(queue);
+        }
+        for (auto block : blocks) {
+            BiasedRefCount::MergeQueuedBlock(block, id);
+        }
+    }
+
+    static Thread& Current() {
+        thread_local Thread thread;
+        return thread;
+    }
+
+    // 0 until the thread creates its first biased block, ids start from 1
+    static uint64_t& CurrentId() {
+        thread_local uint64_t id = 0;
+        return id;
+    }
+
+    static uint64_t NextId() {
+        static std::atomic<uint64_t> next_id = 1;
+        return next_id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static std::mutex& Mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::unordered_map<uint64_t, Thread*>& Registry() {
+        static std::unordered_map<uint64_t, Thread*> registry;
+        return registry;
+    }
+
+    const uint64_t id;
+    std::vector<ControlBlockBiasedBase*> queue;  // guarded by `Mutex()`
+    std::atomic<bool> has_queued = false;
+};
+
+// Counters of a block counted with `BiasedRefCount`. The owner thread keeps its references in
+// `biased_` with plain loads and stores, every other thread goes to `shared_`. The strong count of
+// `ControlBlockBase` is not used, its weak count holds the reference of the strong ones as usual.
+class ControlBlockBiasedBase : public ControlBlockBase {
+protected:
+    explicit ControlBlockBiasedBase(const VTable* vtable)
+        : ControlBlockBase(vtable), owner_(BiasedRefCount::Thread::Current().id) {
+    }
+
+private:
+    friend struct BiasedRefCount;
+
+    static constexpr uint64_t kNoOwner = ~uint64_t(0);  // the biased count was merged
+    static constexpr int64_t kMerged = 1;               // flags in the low bits of `shared_`
+    static constexpr int64_t kQueued = 2;
+    static constexpr int64_t kOne = 4;
+
+    std::atomic<uint64_t> owner_;
+    std::atomic<size_t> biased_ = 0;  // only the owner writes it, atomic just for `UseCount`
+    std::atomic<int64_t> shared_ = 0;  // count * kOne + flags, negative while the owner is in debt
+};
+
+template <typename Y>
+class ControlBlockBiasedHolder : public ControlBlockBiasedBase {
+public:
+    template <typename... Args>
+    ControlBlockBiasedHolder(Args&&... args) : ControlBlockBiasedBase(&kVTable) {
+        new (GetPointer()) Y(std::forward<Args>(args)...);
+    }
+
+    Y* GetPointer() {
+        return reinterpret_cast<Y*>(&storage_);
+    }
+
+private:
+    static void DestroyObject(ControlBlockBase* base) {
+        static_cast<ControlBlockBiasedHolder*>(base)->GetPointer()->~Y();
+    }
+
+    static void DeallocateBlock(ControlBlockBase* base) {
+        delete static_cast<ControlBlockBiasedHolder*>(base);
+    }
+
+    static constexpr VTable kVTable = MakeVTable<Y>(&DestroyObject, &DeallocateBlock);
+
+    alignas(Y) char storage_[sizeof(Y)];
+};
+
+inline void BiasedRefCount::IncStrongRef(ControlBlockBase* base) {
+    auto block = static_cast<ControlBlockBiasedBase*>(base);
+    if (block->owner_.load(std::memory_order_relaxed) == Thread::CurrentId()) {
+        block->biased_.store(block->biased_.load(std::memory_order_relaxed) + 1,
+                             std::memory_order_relaxed);
+    } else {
+        block->shared_.fetch_add(ControlBlockBiasedBase::kOne, std::memory_order_relaxed);
+    }
+}
+
+inline bool BiasedRefCount::ReleaseStrongRef(ControlBlockBase* base) {
+    using Block = ControlBlockBiasedBase;
+    auto block = static_cast<Block*>(base);
+    if (block->owner_.load(std::memory_order_relaxed) == Thread::CurrentId()) {
+        size_t biased = block->biased_.load(std::memory_order_relaxed) - 1;
+        block->biased_.store(biased, std::memory_order_relaxed);
+        if (biased != 0) {
+            return false;
+        }
+        // The owner is done with the object, from now on everybody uses the shared count
+        block->owner_.store(Block::kNoOwner, std::memory_order_relaxed);
+        int64_t old = block->shared_.fetch_or(Block::kMerged, std::memory_order_acq_rel);
+        return (old >> 2) == 0 && DestroyObject(block);
+    }
+
+    // Not the owner: the first time the shared count goes below zero the owner has to merge, so
+    // the block is queued for it. The queue holds a weak reference, taken before the count can
+    // reach zero anywhere else.
+    int64_t old = block->shared_.load(std::memory_order_relaxed);
+    bool weak_taken = false;
+    while (true) {
+        int64_t count = old >> 2;
+        bool queue = !(old & (Block::kMerged | Block::kQueued)) && count - 1 < 0;
+        if (queue && !weak_taken) {
+            block->IncWeakRef();
+            weak_taken = true;
+        }
+        int64_t desired = old - Block::kOne + (queue ? Block::kQueued : 0);
+        if (block->shared_.compare_exchange_weak(old, desired, std::memory_order_acq_rel,
+                                                 std::memory_order_relaxed)) {
+            if (queue) {
+                Queue(block);
+                return false;
+            }
+            bool last = false;
+            if ((desired & Block::kMerged) && (desired >> 2) == 0) {
+                last = DestroyObject(block);
+            }
+            if (weak_taken) {
+                last |= block->DecWeakRef();
+            }
+            return last;
+        }
+    }
+}
+
+inline size_t BiasedRefCount::UseCount(const ControlBlockBase* base) {
+    auto block = static_cast<const ControlBlockBiasedBase*>(base);
+    int64_t shared = block->shared_.load(std::memory_order_relaxed) >> 2;
+    return block->biased_.load(std::memory_order_relaxed) + shared;
+}
+
+inline void BiasedRefCount::MergeQueued() {
+    Thread& thread = Thread::Current();
+    if (!thread.has_queued.load(std::memory_order_acquire)) {
+        return;
+    }
+    while (true) {
+        std::vector<ControlBlockBiasedBase*> blocks;
+        {
+            std::lock_guard lock(Thread::Mutex());
+            blocks.swap(thread.queue);
+            thread.has_queued.store(false, std::memory_order_relaxed);
+        }
+        if (blocks.empty()) {
+            return;
+        }
+        for (auto block : blocks) {  // destructors may queue more blocks
+            MergeQueuedBlock(block, thread.id);
+        }
+    }
+}
+
+inline void BiasedRefCount::Queue(ControlBlockBiasedBase* block) {
+    uint64_t owner = block->owner_.load(std::memory_order_relaxed);
+    {
+        std::lock_guard lock(Thread::Mutex());
+        auto it = Thread::Registry().find(owner);
+        if (it != Thread::Registry().end()) {
+            it->second->queue.push_back(block);
+            it->second->has_queued.store(true, std::memory_order_release);
+            return;
+        }
+    }
+    // The owner has exited and will not touch the biased count again
+    MergeQueuedBlock(block, owner);
+}
+
+// Moves the biased count of `owner` into the shared one and drops the reference of the queue
+inline void BiasedRefCount::MergeQueuedBlock(ControlBlockBiasedBase* block, uint64_t owner) {
+    using Block = ControlBlockBiasedBase;
+    bool last = false;
+    if (block->owner_.load(std::memory_order_relaxed) == owner) {  // not merged on release
+        auto biased = static_cast<int64_t>(block->biased_.load(std::memory_order_relaxed));
+        block->biased_.store(0, std::memory_order_relaxed);
+        block->owner_.store(Block::kNoOwner, std::memory_order_relaxed);
+        int64_t old = block->shared_.fetch_add(biased * Block::kOne + Block::kMerged,
+                                               std::memory_order_acq_rel);
+        if ((old >> 2) + biased == 0) {
+            last = DestroyObject(block);
+        }
+    }
+    last |= block->DecWeakRef();
+    if (last) {
+        block->DeallocateBlock();
+    }
+}
+
+// Runs the destructor and drops the weak reference of the strong ones, true if it was the last
+inline bool BiasedRefCount::DestroyObject(ControlBlockBase* block) {
+    block->DestroyObject();
+    return block->DecWeakRef();
+}
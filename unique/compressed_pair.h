@@ -24,6 +24,8 @@ class CompressedPair<F, S, true, true, false> : F, S {
 public:
     CompressedPair() {
     }
+    explicit CompressedPair(const F& first) : F(first) {
+    }
     CompressedPair(const F& first, const S& second) : F(first), S(second) {
     }
     CompressedPair(F&& first, const S& second) : F(std::move(first)), S(second) {
@@ -55,6 +57,8 @@ class CompressedPair<F, S, true, false, false> : F {
 public:
     CompressedPair() : second_() {
     }
+    explicit CompressedPair(const F& first) : F(first), second_() {
+    }
     CompressedPair(const F& first, const S& second) : F(first), second_(second) {
     }
     CompressedPair(F&& first, const S& second) : F(std::move(first)), second_(second) {
@@ -89,6 +93,8 @@ class CompressedPair<F, S, false, true, false> : S {
 public:
     CompressedPair() : first_() {
     }
+    explicit CompressedPair(const F& first) : first_(first) {
+    }
     CompressedPair(const F& first, const S& second) : first_(first), S(second) {
     }
     CompressedPair(F&& first, const S& second) : first_(std::move(first)), S(second) {
@@ -123,6 +129,8 @@ class CompressedPair<F, S, false, false, false> {
 public:
     CompressedPair() : first_(), second_() {
     }
+    explicit CompressedPair(const F& first) : first_(first), second_() {
+    }
     CompressedPair(const F& first, const S& second) : first_(first), second_(second) {
     }
     CompressedPair(F&& first, const S& second) : first_(std::move(first)), second_(second) {
@@ -158,6 +166,8 @@ class CompressedPair<F, S, true, true, true> : F {
 public:
     CompressedPair() : first_() {
     }
+    explicit CompressedPair(const F& first) : first_(first) {
+    }
     CompressedPair(const F& first, const S& second) : first_(first), S(second) {
     }
     CompressedPair(F&& first, const S& second) : first_(std::move(first)), S(second) {
@@ -192,6 +202,8 @@ class CompressedPair<F, S, true, false, true> : F {
 public:
     CompressedPair() : second_() {
     }
+    explicit CompressedPair(const F& first) : F(first), second_() {
+    }
     CompressedPair(const F& first, const S& second) : F(first), second_(second) {
     }
     CompressedPair(F&& first, const S& second) : F(std::move(first)), second_(second) {
@@ -226,6 +238,8 @@ class CompressedPair<F, S, false, true, true> : S {
 public:
     CompressedPair() : first_() {
     }
+    explicit CompressedPair(const F& first) : first_(first) {
+    }
     CompressedPair(const F& first, const S& second) : first_(first), S(second) {
     }
     CompressedPair(F&& first, const S& second) : first_(std::move(first)), S(second) {
@@ -260,6 +274,8 @@ class CompressedPair<F, S, false, false, true> {
 public:
     CompressedPair() : first_(), second_() {
     }
+    explicit CompressedPair(const F& first) : first_(first), second_() {
+    }
     CompressedPair(const F& first, const S& second) : first_(first), second_(second) {
     }
     CompressedPair(F&& first, const S& second) : first_(std::move(first)), second_(second) {
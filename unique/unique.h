@@ -2,6 +2,8 @@
 
 #include "compressed_pair.h"
 
+#include <common/relocate.h>
+
 #include <cstddef>  // std::nullptr_t
 #include <algorithm>
 
@@ -88,7 +90,7 @@ public:
             GetDeleter()(old_ptr);
         }
     }
-    void Swap(UniquePtr& other) {
+    void Swap(UniquePtr& other) noexcept {
         std::swap(CpPtr(), other.CpPtr());
         std::swap(CpDeleter(), other.CpDeleter());
     }
@@ -200,7 +202,7 @@ public:
             GetDeleter()(old_ptr);
         }
     }
-    void Swap(UniquePtr& other) {
+    void Swap(UniquePtr& other) noexcept {
         std::swap(CpPtr(), other.CpPtr());
         std::swap(CpDeleter(), other.CpDeleter());
     }
@@ -253,3 +255,8 @@ private:
         return data_.GetFirst();
     }
 };
+
+// Relocatable if the deleter is, see common/relocate.h
+template <typename T, typename Deleter>
+inline constexpr bool kTriviallyRelocatable<UniquePtr<T, Deleter>> =
+    kTriviallyRelocatable<Deleter>;
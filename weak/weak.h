@@ -2,6 +2,8 @@
 
 #include "sw_fwd.h"  // Forward declaration
 
+#include <common/relocate.h>
+
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
 template <typename T>
 class WeakPtr {
@@ -25,7 +27,7 @@ public:
         }
     }
 
-    WeakPtr(WeakPtr&& other) {
+    WeakPtr(WeakPtr&& other) noexcept {
         Dispose();
         ptr_ = other.ptr_;
         block_ = other.block_;
@@ -35,7 +37,7 @@ public:
     }
 
     template <typename Up>
-    WeakPtr(WeakPtr<Up>&& other) {
+    WeakPtr(WeakPtr<Up>&& other) noexcept {
         Dispose();
         ptr_ = other.ptr_;
         block_ = other.block_;
@@ -77,7 +79,7 @@ public:
         return *this;
     }
 
-    WeakPtr& operator=(WeakPtr&& other) {
+    WeakPtr& operator=(WeakPtr&& other) noexcept {
         Dispose();
         ptr_ = other.ptr_;
         block_ = other.block_;
@@ -88,7 +90,7 @@ public:
     }
 
     template <typename Up>
-    WeakPtr& operator=(WeakPtr<Up>&& other) {
+    WeakPtr& operator=(WeakPtr<Up>&& other) noexcept {
         Dispose();
         ptr_ = other.ptr_;
         block_ = other.block_;
@@ -126,7 +128,7 @@ public:
         ptr_ = nullptr;
         block_ = nullptr;
     }
-    void Swap(WeakPtr& other) {
+    void Swap(WeakPtr& other) noexcept {
         std::swap(ptr_, other.ptr_);
         std::swap(block_, other.block_);
     }
@@ -143,33 +145,34 @@ public:
     bool Expired() const {
         return (UseCount() == 0);
     }
-    SharedPtr<T> Lock() const {
-        if (Expired()) {
-            return SharedPtr<T>();
-        }
-        return SharedPtr<T>(*this);
+    // Empty if the object is gone. One CAS loop on the counts, no exceptions: safe to call while
+    // other threads drop the last owners.
+    SharedPtr<T> TryLock() const noexcept {
+        return SharedPtr<T>(*this, std::nothrow);
+    }
+    SharedPtr<T> Lock() const noexcept {
+        return TryLock();
     }
 
 private:
-    T* ptr_ = nullptr;
+    std::remove_extent_t<T>* ptr_ = nullptr;
     ControlBlockBase* block_ = nullptr;
 
     void Dispose() {  // this method is actually deleting the block
         if (block_) {
-            block_->DecWeakRef();
-        }
-        if (block_) {
-            if (block_->GetStrongRefCount() == 0 &&
-                block_->GetWeakRefCount() == 0) {  // may be "delete nullptr"
-                delete block_;
-                block_ = nullptr;
+            if (block_->DecWeakRef()) {
+                block_->DeallocateBlock();
             }
+            block_ = nullptr;
         }
     }
 
-    template <typename Y>
+    template <typename Y, typename Policy>
     friend class SharedPtr;
 
     template <typename Y>
     friend class WeakPtr;
 };
+
+template <typename T>
+inline constexpr bool kTriviallyRelocatable<WeakPtr<T>> = true;